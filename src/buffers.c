@@ -8,6 +8,7 @@
 #include <libgen.h>
 #ifndef DOSLIKE
 #include <sys/select.h>
+#include <sys/mman.h>
 #endif
 
 /* If this include file is missing, you need the pcre package,
@@ -61,6 +62,7 @@ static int undoField;
 void undoSpecialClear(void) { nzFree(undoSpecial), undoSpecial = 0, undo1line = 0; }
 static bool noStack;		/* don't stack up edit sessions */
 static bool globSub;		/* in the midst of a g// command */
+static int gNext;		/* next line for g// to look at */
 static bool inscript;		/* run from inside an edbrowse function */
 static int lastq, lastqq;
 static char icmd;		/* input command, usually the same as cmd */
@@ -152,6 +154,495 @@ addchar:
 	*t = c;			/* terminating character */
 }
 
+/*********************************************************************
+The lines of a buffer, the map, use to be one flat array of struct lineMap,
+and every insert or delete built a new array and copied the whole thing over.
+That is quadratic when you stream a million lines into a buffer.
+Now the lines are kept in chunks of at most LINECHUNK entries.
+A binary indexed tree over the chunk sizes finds the chunk holding line n
+in log time, and the last chunk visited is remembered,
+so walking through the buffer from top to bottom costs nothing extra.
+Inserting or deleting a few lines only shifts entries within one chunk.
+A chunk that overflows is split, and a chunk that empties out is dropped.
+Line numbers still start at 1, and an empty buffer still has no map.
+*********************************************************************/
+
+#define LINECHUNK 1024
+
+struct lineChunk {
+	int n, cap;		/* lines in use, and room for */
+	struct lineMap l[];
+};
+
+struct lineIndex {
+	struct lineChunk **chunks;
+	int *fen;		/* binary indexed tree of chunk sizes */
+	int nchunks, allocChunks;
+	int dol;		/* total lines */
+	int hint, hintStart;	/* last chunk visited, lines before it */
+	unsigned serial;	/* new with every insert or delete */
+};
+
+/* serial numbers are never reused, so a changed map is never mistaken
+ * for the one that was there before */
+static unsigned mapSerials;
+static unsigned changeSerials;
+
+static unsigned mapSerial(const struct lineIndex *x)
+{
+	return (x ? x->serial : 0);
+}
+
+static struct lineChunk *newChunk(int cap)
+{
+	struct lineChunk *ch;
+	if (cap > LINECHUNK)
+		cap = LINECHUNK;
+	ch = allocMem(sizeof(struct lineChunk) + cap * LMSIZE);
+	ch->n = 0, ch->cap = cap;
+	return ch;
+}
+
+/* make room in a chunk, which may move it */
+static struct lineChunk *growChunk(struct lineChunk *ch, int want)
+{
+	int cap = ch->cap;
+	if (want <= cap)
+		return ch;
+	while (cap < want)
+		cap *= 2;
+	if (cap > LINECHUNK)
+		cap = LINECHUNK;
+	ch = reallocMem(ch, sizeof(struct lineChunk) + cap * LMSIZE);
+	ch->cap = cap;
+	return ch;
+}
+
+static void fenAdd(struct lineIndex *x, int c, int delta)
+{
+	for (++c; c <= x->nchunks; c += (c & -c))
+		x->fen[c] += delta;
+}
+
+static int fenPrefix(const struct lineIndex *x, int c)
+{
+	int sum = 0;
+	for (; c > 0; c -= (c & -c))
+		sum += x->fen[c];
+	return sum;
+}
+
+static void fenRebuild(struct lineIndex *x)
+{
+	int i, j;
+	for (i = 1; i <= x->nchunks; ++i)
+		x->fen[i] = x->chunks[i - 1]->n;
+	for (i = 1; i <= x->nchunks; ++i) {
+		j = i + (i & -i);
+		if (j <= x->nchunks)
+			x->fen[j] += x->fen[i];
+	}
+	x->hint = x->hintStart = 0;
+}
+
+/* Find the chunk holding line n, and the number of lines before it. */
+static int findChunk(const struct lineIndex *x, int n, int *before)
+{
+	int pos = 0, mask = 1, rem = n;
+	while (mask * 2 <= x->nchunks)
+		mask *= 2;
+	for (; mask; mask >>= 1)
+		if (pos + mask <= x->nchunks && x->fen[pos + mask] < rem) {
+			pos += mask;
+			rem -= x->fen[pos];
+		}
+	*before = n - rem;
+	return pos;
+}
+
+/* room for more chunks in the directory */
+static void moreChunks(struct lineIndex *x, int more)
+{
+	int a = x->allocChunks;
+	if (x->nchunks + more <= a)
+		return;
+	a = (a ? a * 2 : 8);
+	if (a < x->nchunks + more)
+		a = x->nchunks + more;
+	if (x->chunks) {
+		x->chunks =
+		    reallocMem(x->chunks, a * sizeof(struct lineChunk *));
+		x->fen = reallocMem(x->fen, (a + 1) * sizeof(int));
+	} else {
+		x->chunks = allocMem(a * sizeof(struct lineChunk *));
+		x->fen = allocZeroMem((a + 1) * sizeof(int));
+	}
+	x->allocChunks = a;
+}
+
+/* Return line n, from 1 to dol, in this map. */
+struct lineMap *lineAt(struct lineIndex *x, int n)
+{
+	int c = x->hint, before = x->hintStart;
+	const struct lineChunk *ch = x->chunks[c];
+	if (n <= before || n > before + ch->n) {
+		if (n > before && c + 1 < x->nchunks &&
+		    n <= before + ch->n + x->chunks[c + 1]->n) {
+// next chunk down, as when walking the buffer
+			before += ch->n, ++c;
+		} else {
+			c = findChunk(x, n, &before);
+		}
+		x->hint = c, x->hintStart = before;
+	}
+	return x->chunks[c]->l + (n - before - 1);
+}
+
+/* The chunk holding line n, whose lines are lo through hi.
+ * This doesn't use or set the hint, so threads can share the map. */
+static struct lineMap *lineSpan(const struct lineIndex *x, int n,
+				int *lo, int *hi)
+{
+	int before, c = findChunk(x, n, &before);
+	*lo = before + 1, *hi = before + x->chunks[c]->n;
+	return x->chunks[c]->l;
+}
+
+/* Add nlines lines after line destl, creating the map if need be.
+ * The line structures are copied; the text is not. */
+static void insertLines(struct lineIndex **xp, int destl,
+			const struct lineMap *lines, int nlines)
+{
+	struct lineIndex *x = *xp;
+	struct lineChunk *ch;
+	struct lineMap *all;
+	int c, o, before, total, m, j, k, from, to;
+
+	if (!x)
+		x = *xp = allocZeroMem(sizeof(struct lineIndex));
+	x->serial = ++mapSerials;
+
+	if (destl == x->dol) {
+/* Append; this is how files are read and output streams in.
+ * Fill up the last chunk, then add full chunks, which extend the
+ * indexed tree one node at a time. */
+		if (x->nchunks) {
+			c = x->nchunks - 1;
+			ch = x->chunks[c];
+			k = LINECHUNK - ch->n;
+			if (k > nlines)
+				k = nlines;
+			if (k) {
+				ch = x->chunks[c] = growChunk(ch, ch->n + k);
+				memcpy(ch->l + ch->n, lines, k * LMSIZE);
+				ch->n += k;
+				fenAdd(x, c, k);
+				lines += k, nlines -= k, x->dol += k;
+			}
+		}
+		while (nlines) {
+			k = (nlines > LINECHUNK ? LINECHUNK : nlines);
+			ch = newChunk(k);
+			memcpy(ch->l, lines, k * LMSIZE);
+			ch->n = k;
+			moreChunks(x, 1);
+			c = x->nchunks++;
+			x->chunks[c] = ch;
+			j = c + 1;
+			x->fen[j] = k + fenPrefix(x, c) - fenPrefix(x, j - (j & -j));
+			lines += k, nlines -= k, x->dol += k;
+		}
+		return;
+	}
+
+	c = findChunk(x, destl + 1, &before);
+	ch = x->chunks[c];
+	o = destl - before;
+	if (ch->n + nlines <= LINECHUNK) {
+		ch = x->chunks[c] = growChunk(ch, ch->n + nlines);
+		memmove(ch->l + o + nlines, ch->l + o, (ch->n - o) * LMSIZE);
+		memcpy(ch->l + o, lines, nlines * LMSIZE);
+		ch->n += nlines;
+		x->dol += nlines;
+		fenAdd(x, c, nlines);
+		x->hint = x->hintStart = 0;
+		return;
+	}
+
+/* Split this chunk, spreading its lines and the new ones evenly
+ * across chunks that are 3/4 full, leaving room for later inserts. */
+	total = ch->n + nlines;
+	all = allocMem(total * LMSIZE);
+	memcpy(all, ch->l, o * LMSIZE);
+	memcpy(all + o, lines, nlines * LMSIZE);
+	memcpy(all + o + nlines, ch->l + o, (ch->n - o) * LMSIZE);
+	m = total / (LINECHUNK / 4 * 3) + 1;
+	moreChunks(x, m - 1);
+	memmove(x->chunks + c + m, x->chunks + c + 1,
+		(x->nchunks - c - 1) * sizeof(struct lineChunk *));
+	x->nchunks += m - 1;
+	for (j = 0; j < m; ++j) {
+		from = (long long)total * j / m;
+		to = (long long)total * (j + 1) / m;
+		if (j)
+			ch = newChunk(to - from);
+		else
+			ch = growChunk(ch, to - from);
+		memcpy(ch->l, all + from, (to - from) * LMSIZE);
+		ch->n = to - from;
+		x->chunks[c + j] = ch;
+	}
+	free(all);
+	x->dol += nlines;
+	fenRebuild(x);
+}
+
+/* Remove lines start through end from the map.
+ * This does not free the text; the caller does that, or not.
+ * An empty map is freed altogether. */
+static void removeLines(struct lineIndex **xp, int start, int end)
+{
+	struct lineIndex *x = *xp;
+	struct lineChunk *ch, *next;
+	int c, c0, o, before, cnt, k;
+	bool restructure = false;
+
+	cnt = end - start + 1;
+	x->dol -= cnt;
+	x->serial = ++mapSerials;
+	if (!x->dol) {
+		freeLineIndex(x);
+		*xp = 0;
+		return;
+	}
+
+	c = c0 = findChunk(x, start, &before);
+	while (cnt) {
+		ch = x->chunks[c];
+		o = start - before - 1;
+		k = ch->n - o;
+		if (k > cnt)
+			k = cnt;
+		memmove(ch->l + o, ch->l + o + k, (ch->n - o - k) * LMSIZE);
+		ch->n -= k, cnt -= k;
+		if (ch->n) {
+			fenAdd(x, c, -k);
+			before += ch->n, ++c;
+			continue;
+		}
+		free(ch);
+		--x->nchunks;
+		memmove(x->chunks + c, x->chunks + c + 1,
+			(x->nchunks - c) * sizeof(struct lineChunk *));
+		restructure = true;
+	}
+
+/* Merge small neighbors, so deletes don't leave a trail of tiny chunks. */
+	if (c0 > 0)
+		--c0;
+	for (k = 0; k < 2 && c0 + 1 < x->nchunks; ++k) {
+		ch = x->chunks[c0];
+		next = x->chunks[c0 + 1];
+		if (ch->n + next->n > LINECHUNK / 2) {
+			++c0;
+			continue;
+		}
+		ch = x->chunks[c0] = growChunk(ch, ch->n + next->n);
+		memcpy(ch->l + ch->n, next->l, next->n * LMSIZE);
+		ch->n += next->n;
+		free(next);
+		--x->nchunks;
+		memmove(x->chunks + c0 + 1, x->chunks + c0 + 2,
+			(x->nchunks - c0 - 1) * sizeof(struct lineChunk *));
+		restructure = true;
+	}
+
+	if (restructure)
+		fenRebuild(x);
+	else
+		x->hint = x->hintStart = 0;
+}
+
+/* Build a map from a flat array of lines. */
+struct lineIndex *newLineIndex(const struct lineMap *lines, int nlines)
+{
+	struct lineIndex *x = 0;
+	if (nlines)
+		insertLines(&x, 0, lines, nlines);
+	return x;
+}
+
+/* Free the map itself, not the text of the lines. */
+void freeLineIndex(struct lineIndex *x)
+{
+	int c;
+	if (!x)
+		return;
+	for (c = 0; c < x->nchunks; ++c)
+		free(x->chunks[c]);
+	free(x->chunks);
+	free(x->fen);
+	free(x);
+}
+
+/*********************************************************************
+The text of the lines use to be allocated one line at a time,
+and freed one line at a time.
+Reading a 500 meg file meant millions of mallocs,
+and quitting that buffer meant millions of frees.
+Now a block of text coming into the buffer is copied into a slab,
+and the lines point into it.
+Small pieces of text share the window's open slab, until it fills up;
+a large block gets a slab of its own.
+Each slab counts the lines that still live in it,
+plus one while it is some window's open slab,
+and it is freed when that count drops to 0.
+Lines are still freed one at a time, by undoCompare, delText, etc,
+and the undo history and r_map still share lines with the buffer,
+because a line is only ever freed once, whoever holds it.
+A sorted list of slabs tells us whether a line lives in a slab
+or was allocated on its own, as lines from other sources still are.
+A file read by em is a slab too, one that is mapped rather than allocated.
+*********************************************************************/
+
+#define SLABSIZE 0x10000
+#define SLABBIG 0x4000		/* text this large gets its own slab */
+
+struct textSlab {
+	char *base;
+	size_t size, used;
+	int refs;
+	bool mapped;		/* mmap of a file, from em */
+	dev_t dev;		/* the file that is mapped, see unmapFile() */
+	ino_t ino;
+};
+
+static struct textSlab **slabList;
+static int slabCount, slabAlloc;
+/* Lines are usually freed in runs from the same slab; remember the last. */
+static struct textSlab *lastSlab;
+
+static int slabSlot(const char *p)
+{
+	int lo = 0, hi = slabCount, mid;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (slabList[mid]->base < p)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static struct textSlab *addSlab(char *base, size_t size)
+{
+	struct textSlab *sl = allocZeroMem(sizeof(struct textSlab));
+	int j;
+	sl->base = base;
+	sl->size = size;
+	if (slabCount == slabAlloc) {
+		slabAlloc = (slabAlloc ? slabAlloc * 2 : 64);
+		if (slabList)
+			slabList = reallocMem(slabList,
+					      slabAlloc * sizeof(struct textSlab *));
+		else
+			slabList = allocMem(slabAlloc * sizeof(struct textSlab *));
+	}
+	j = slabSlot(sl->base);
+	memmove(slabList + j + 1, slabList + j,
+		(slabCount - j) * sizeof(struct textSlab *));
+	slabList[j] = sl;
+	++slabCount;
+	return sl;
+}
+
+static struct textSlab *newSlab(size_t size)
+{
+	return addSlab(allocMem(size), size);
+}
+
+static struct textSlab *findSlab(const char *p)
+{
+	int lo = 0, hi = slabCount - 1, mid;
+	struct textSlab *sl = lastSlab;
+	if (sl && p >= sl->base && p < sl->base + sl->size)
+		return sl;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		sl = slabList[mid];
+		if (p < sl->base)
+			hi = mid - 1;
+		else if (p >= sl->base + sl->size)
+			lo = mid + 1;
+		else
+			return lastSlab = sl;
+	}
+	return 0;
+}
+
+static void dropSlab(struct textSlab *sl)
+{
+	int j;
+	if (--sl->refs)
+		return;
+	j = slabSlot(sl->base);
+	--slabCount;
+	memmove(slabList + j, slabList + j + 1,
+		(slabCount - j) * sizeof(struct textSlab *));
+	if (lastSlab == sl)
+		lastSlab = 0;
+	debugPrint(6, "free slab %zu", sl->size);
+#ifndef DOSLIKE
+	if (sl->mapped)
+		munmap(sl->base, sl->size);
+	else
+#endif
+		free(sl->base);
+	free(sl);
+}
+
+/* Room for len bytes of text, holding nlines lines, owned by window w. */
+static char *slabSpace(Window *w, size_t len, int nlines)
+{
+	struct textSlab *sl = w->slab;
+	char *p;
+	if (len >= SLABBIG) {
+		sl = newSlab(len);
+		sl->used = len;
+		sl->refs = nlines;
+		return sl->base;
+	}
+	if (!sl || sl->size - sl->used < len) {
+		if (sl)
+			dropSlab(sl);
+		sl = w->slab = newSlab(SLABSIZE);
+		sl->refs = 1;
+	}
+	p = sl->base + sl->used;
+	sl->used += len;
+	sl->refs += nlines;
+	return p;
+}
+
+/* The window lets go of its open slab; lines in that slab live on. */
+static void closeSlab(Window *w)
+{
+	if (w->slab)
+		dropSlab(w->slab);
+	w->slab = 0;
+}
+
+/* Free the text of a line, wherever it came from. */
+void freeLineText(pst p)
+{
+	struct textSlab *sl = findSlab((char *)p);
+	if (sl)
+		dropSlab(sl);
+	else
+		nzFree(p);
+}
+
 /* Fetch line n from the current buffer, or perhaps another buffer.
  * This returns an allocated copy of the string,
  * and you need to free it when you're done.
@@ -167,18 +658,15 @@ addchar:
 static pst fetchLineContext(int n, int show, int cx)
 {
 	Window *lw = sessionList[cx].lw;
-	struct lineMap *map, *t;
-	int dol;
+	struct lineMap *t;
 	pst p;			/* the resulting copy of the string */
 
 	if (!lw)
 		i_printfExit(MSG_InvalidSession, cx);
-	map = lw->map;
-	dol = lw->dol;
-	if (n <= 0 || n > dol)
+	if (n <= 0 || n > lw->dol)
 		i_printfExit(MSG_InvalidLineNb, n);
 
-	t = map + n;
+	t = lineAt(lw->map, n);
 	if (show < 0)
 		return t->text;
 	p = clonePstring(t->text);
@@ -192,6 +680,31 @@ pst fetchLine(int n, int show)
 	return fetchLineContext(n, show, context);
 }
 
+/*********************************************************************
+Searches, g//, and the p and l commands only read the line,
+they don't need their own copy, and making millions of copies
+to look at a large buffer is where the time went.
+lineView returns the line in place, and its length without the \n,
+if you ask for it.
+Browse mode still has to take the hidden numbers out,
+and that is a copy; *copied says whether the caller must free it.
+Don't change the line through this pointer.
+*********************************************************************/
+
+static pst lineView(int n, int *len, bool *copied)
+{
+	pst p = fetchLine(n, -1);
+	*copied = false;
+	if (cw->browseMode) {
+		p = clonePstring(p);
+		removeHiddenNumbers(p, '\n');
+		*copied = true;
+	}
+	if (len)
+		*len = pstLength(p) - 1;
+	return p;
+}
+
 static int apparentSizeW(const Window *w, bool browsing)
 {
 	int ln, size = 0;
@@ -199,7 +712,7 @@ static int apparentSizeW(const Window *w, bool browsing)
 	if (!w)
 		return -1;
 	for (ln = 1; ln <= w->dol; ++ln) {
-		p = w->map[ln].text;
+		p = lineAt(w->map, ln)->text;
 		while (*p != '\n') {
 			if (*p == InternalCodeChar && browsing && w->browseMode) {
 				++p;
@@ -238,7 +751,7 @@ static char *dirSuffixContext(int n, int cx)
 
 	suffix[0] = 0;
 	if (lw->dirMode) {
-		struct lineMap *s = lw->map + n;
+		struct lineMap *s = lineAt(lw->map, n);
 		suffix[0] = s->ds1;
 		suffix[1] = s->ds2;
 		suffix[2] = 0;
@@ -254,7 +767,8 @@ static char *dirSuffix(int n)
 /* Display a line to the screen, with a limit on output length. */
 void displayLine(int n)
 {
-	pst line = fetchLine(n, 1);
+	bool copied;
+	pst line = lineView(n, 0, &copied);
 	pst s = line;
 	int cnt = 0;
 	uchar c;
@@ -297,7 +811,7 @@ void displayLine(int n)
 	if (cw->dirMode) {
 		stringAndString(&output, &output_l, dirSuffix(n));
 		if (cw->r_map) {
-			s = cw->r_map[n].text;
+			s = lineAt(cw->r_map, n)->text;
 			if (*s) {
 				stringAndChar(&output, &output_l, ' ');
 				stringAndString(&output, &output_l, (char *)s);
@@ -308,7 +822,8 @@ void displayLine(int n)
 		stringAndChar(&output, &output_l, '$');
 	eb_puts(output);
 
-	free(line);
+	if (copied)
+		free(line);
 	nzFree(output);
 }
 
@@ -861,129 +1376,120 @@ static void freeLine(struct lineMap *t)
 			printf("free ");
 		print_pst(t->text);
 	}
-	nzFree(t->text);
+	freeLineText(t->text);
 }
 
-static void freeWindowLines(struct lineMap *map)
+static void freeWindowLines(struct lineIndex *map)
 {
-	struct lineMap *t;
-	int cnt = 0;
+	struct lineChunk *ch;
+	int c, j, cnt = 0;
 
-	if ((t = map)) {
-		for (++t; t->text; ++t) {
-			freeLine(t);
-			++cnt;
+	if (map) {
+		for (c = 0; c < map->nchunks; ++c) {
+			ch = map->chunks[c];
+			for (j = 0; j < ch->n; ++j)
+				freeLine(ch->l + j);
+			cnt += ch->n;
 		}
-		free(map);
+		freeLineIndex(map);
 	}
 
 	debugPrint(6, "freeWindowLines = %d", cnt);
 }
 
 /*********************************************************************
-Garbage collection for text lines.
-There is an undo window that holds a snapshot of the buffer as it was before.
-not a copy of all the text, but a copy of map,
-and dot and dollar and some other things.
-This starts out with map = 0.
-The u command swaps undoWindow and current window (cw).
-Thus another u undoes your undo.
-You can step back through all your changes,
-popping a stack like a modern editor. Sorry.
-Just don't screw up more than once,
-and don't save your file til you're sure it's ok.
-No autosave feature here, I never liked that anyways.
+Undo.
+This use to be a snapshot of the whole map, taken before the first change
+of each command, and when that snapshot was thrown away,
+both maps were sorted to find the lines that only the snapshot held.
+On a million line file, every edit was a big copy and two big sorts.
+Now each command that changes the buffer gets an undo record,
+a log of what it did to the map, one operation at a time:
+lines added, lines deleted, a line changed, a block moved, two lines swapped.
+Deleted lines, and the old version of a changed line, are kept in the record,
+and nowhere else, so the record owns them, and frees them when it goes away.
+Undoing a record runs its operations backwards, each one reversed,
+and that leaves the record as the log of how to redo the change.
+So there is a stack of records to undo, and a stack to redo,
+and every u just moves a record from one to the other.
+u toggles the last change, as it always has, so u u puts it back.
+u- steps further back, and u+ steps forward again.
+Any new change empties the redo stack, and the undo stack holds
+the last UNDOLEVELS changes.
+The dot and the labels are saved in the record, and swapped, like the old undo.
 So at the start of every command not under g//, set madeChanges = false.
-If we're about to change something in the buffer, set madeChanges = true.
-But if madeChanges was false, i.e. this is the first change coming,
-call undoPush().
-This pushes the undo window off the cliff,
-and that means we have to free the text first.
-Call undoCompare().
-This finds any lines in the undo window that aren't in cw and frees them.
-That is a quicksort on both maps and then a comm -23.
-Then it frees undoWindow.map just to make sure we don't free things twice.
-Then undoPush copies cw onto undoWindow, ready for the u command.
-Return, and the calling function makes its change.
-But we call undoCompare at other times, like switching buffers,
-pop the window stack, browse, or quit.
-These make undo impossible, so free the lines in the undo window.
+If we're about to change something in the buffer, call undoPush(),
+which opens a record for the first change of this command,
+and the functions that change the map log their operations into it.
+The history belongs to one window, the window that made it;
+switching buffers, browsing, quitting, etc, calls undoCompare(),
+which frees the lines held by the history and forgets it.
 *********************************************************************/
 
-static bool madeChanges;
-static Window undoWindow;
+#define UNDOLEVELS 100
 
-/* quick sort compare */
-static int qscmp(const void *s, const void *t)
-{
-	return memcmp(s, t, sizeof(char *));
-}				/* qscmp */
+struct undoOp {
+	char op;		/* a d c m x */
+	int ln, n;		/* a: n lines after ln, d: n lines at ln, c: line ln */
+	int dest;		/* m: n lines at ln go after dest, x: ln <-> dest */
+	struct lineMap *lines;	/* lines taken out of the buffer, d and c */
+};
 
-/* Free undo lines not used by the current session. */
-static void undoCompare(void)
-{
-	const struct lineMap *cmap = cw->map;
-	struct lineMap *map = undoWindow.map;
-	struct lineMap *cmap2;
-	struct lineMap *s, *t;
-	int diff, cnt = 0;
-
-	if (!cmap) {
-		debugPrint(6, "undoCompare no current map");
-		freeWindowLines(undoWindow.map);
-		undoWindow.map = 0;
-		return;
-	}
+struct undoRec {
+	struct undoRec *next;	/* older change */
+	struct undoOp *ops;
+	int nops, allocOps;
+	int dot;
+	int labels[MARKLETTERS];
+};
 
-	if (!map) {
-		debugPrint(6, "undoCompare no undo map");
-		return;
-	}
+static bool madeChanges;
+static struct undoRec *undoList, *redoList;
+static int undoDepth;
+static struct undoRec *undoOpen;	/* logging the current command */
+static Window *undoOwner;
+static char undoLast;		/* u toggles between - and + */
 
-/* sort both arrays, run comm, and find out which lines are not needed any more,
-then free them.
- * Use quick sort; some files are a million lines long.
- * I have to copy the second array, so I can sort it.
- * The first I can sort in place, cause it's going to get thrown away. */
-
-	cmap2 = allocMem((cw->dol + 2) * LMSIZE);
-	memcpy(cmap2, cmap, (cw->dol + 2) * LMSIZE);
-	debugPrint(8, "qsort %d %d", undoWindow.dol, cw->dol);
-	qsort(map + 1, undoWindow.dol, LMSIZE, qscmp);
-	qsort(cmap2 + 1, cw->dol, LMSIZE, qscmp);
-
-	s = map + 1;
-	t = cmap2 + 1;
-	while (s->text && t->text) {
-		diff = memcmp(s, t, sizeof(char *));
-		if (!diff) {
-			++s, ++t;
-			continue;
-		}
-		if (diff > 0) {
-			++t;
+static int undoFreeRec(struct undoRec *r)
+{
+	struct undoOp *o;
+	int j, cnt = 0;
+	for (o = r->ops; o < r->ops + r->nops; ++o) {
+		if (!o->lines)
 			continue;
-		}
-		freeLine(s);
-		++s;
-		++cnt;
-	}
-
-	while (s->text) {
-		freeLine(s);
-		++s;
-		++cnt;
-	}
+		for (j = 0; j < (o->op == 'c' ? 1 : o->n); ++j)
+			freeLine(o->lines + j);
+		cnt += j;
+		free(o->lines);
+	}
+	nzFree(r->ops);
+	free(r);
+	return cnt;
+}
 
-	free(cmap2);
-	free(map);
-	undoWindow.map = 0;
-	debugPrint(6, "undoCompare strip %d", cnt);
+/* Free the lines held only by the undo history, and forget that history. */
+static void undoCompare(void)
+{
+	struct undoRec *r;
+	int cnt = 0;
+	while ((r = undoList)) {
+		undoList = r->next;
+		cnt += undoFreeRec(r);
+	}
+	while ((r = redoList)) {
+		redoList = r->next;
+		cnt += undoFreeRec(r);
+	}
+	undoDepth = 0;
+	undoOpen = 0;
+	undoOwner = 0;
+	if (cnt)
+		debugPrint(6, "undoCompare strip %d", cnt);
 }				/* undoCompare */
 
 static void undoPush(void)
 {
-	Window *uw;
+	struct undoRec *r, **rp;
 
 /* if in browse mode, we really shouldn't be here at all!
  * But we could if substituting on an input field, since substitute is also
@@ -995,25 +1501,179 @@ static void undoPush(void)
 	madeChanges = true;
 	debugPrint(6, "undoPush");
 
+// history from some other window, or from before undo was turned off
+	if (!cw->undoable || undoOwner != cw)
+		undoCompare();
 	cw->undoable = true;
 	if (!cw->quitMode)
 		cw->changeMode = true;
 
-	undoCompare();
-
-	uw = &undoWindow;
-	uw->dot = cw->dot;
-	uw->dol = cw->dol;
-	memcpy(uw->labels, cw->labels, MARKLETTERS * sizeof(int));
-	uw->binMode = cw->binMode;
-	uw->nlMode = cw->nlMode;
-	uw->dirMode = cw->dirMode;
-	if (cw->map) {
-		uw->map = allocMem((cw->dol + 2) * LMSIZE);
-		memcpy(uw->map, cw->map, (cw->dol + 2) * LMSIZE);
+// a new change, there is nothing to redo
+	while ((r = redoList)) {
+		redoList = r->next;
+		undoFreeRec(r);
+	}
+	undoLast = 0;
+
+	r = allocZeroMem(sizeof(struct undoRec));
+	r->dot = cw->dot;
+	memcpy(r->labels, cw->labels, MARKLETTERS * sizeof(int));
+	r->next = undoList;
+	undoList = undoOpen = r;
+	undoOwner = cw;
+	if (++undoDepth > UNDOLEVELS) {
+		for (rp = &undoList; (*rp)->next; rp = &(*rp)->next) ;
+		undoFreeRec(*rp);
+		*rp = 0;
+		--undoDepth;
 	}
 }				/* undoPush */
 
+/* Stamp the current buffer as changed. Most changes come through undoLog,
+ * but a field updated in place, a delete in browse mode,
+ * which has no undo, and undo itself, call this directly. */
+void bufferChanged(void)
+{
+	cw->changeSerial = ++changeSerials;
+}
+
+/* Log a change to the map, before it is made. */
+static void undoLog(char op, int ln, int n, int dest)
+{
+	struct undoRec *r = undoOpen;
+	struct undoOp *o;
+	int j;
+
+/* Nearly every change to a buffer comes through here, undoable or not,
+ * so this is where the buffer is stamped as changed; see bufferChanged()
+ * for the others. jSyncup uses the stamp to see if a textarea has been edited,
+ * and rerender uses it to see if the buffer is still what it rendered. */
+	bufferChanged();
+
+	if (!r || undoOwner != cw)
+		return;
+	if (r->nops == r->allocOps) {
+		r->allocOps = (r->allocOps ? r->allocOps * 2 : 4);
+		if (r->ops)
+			r->ops =
+			    reallocMem(r->ops, r->allocOps * sizeof(struct undoOp));
+		else
+			r->ops = allocMem(r->allocOps * sizeof(struct undoOp));
+	}
+	o = r->ops + r->nops++;
+	o->op = op, o->ln = ln, o->n = n, o->dest = dest;
+	o->lines = 0;
+	if (op == 'c')
+		n = 1;
+	if (op == 'd' || op == 'c') {
+		o->lines = allocMem(n * LMSIZE);
+		for (j = 0; j < n; ++j)
+			o->lines[j] = *lineAt(cw->map, ln + j);
+	}
+}
+
+/* move n lines at ln to after line dest, dest counted without the block */
+static void moveLines(int ln, int n, int dest)
+{
+	struct lineMap *block = allocMem(n * LMSIZE);
+	int j;
+	for (j = 0; j < n; ++j)
+		block[j] = *lineAt(cw->map, ln + j);
+	removeLines(&cw->map, ln, ln + n - 1);
+	insertLines(&cw->map, dest, block, n);
+	free(block);
+}
+
+/* Swap two lines in the buffer; this can be undone. */
+void swapLines(int a, int b)
+{
+	struct lineMap swap, *q1, *q2;
+	undoLog('x', a, 0, b);
+	q1 = lineAt(cw->map, a);
+	swap = *q1;
+	q2 = lineAt(cw->map, b);
+	*q1 = *q2;
+	*q2 = swap;
+}
+
+/* Run the operations of a record backwards, reversing each one,
+ * so that the record now holds the way back.
+ * This doesn't go through undoLog, so stamp the buffer here. */
+static void undoApply(struct undoRec *r)
+{
+	struct undoOp *o, swapop;
+	struct lineMap swap, *t;
+	int i, j;
+
+	bufferChanged();
+
+	for (o = r->ops + r->nops - 1; o >= r->ops; --o) {
+		switch (o->op) {
+		case 'a':
+			o->lines = allocMem(o->n * LMSIZE);
+			for (j = 0; j < o->n; ++j)
+				o->lines[j] = *lineAt(cw->map, o->ln + 1 + j);
+			removeLines(&cw->map, o->ln + 1, o->ln + o->n);
+			o->op = 'd', ++o->ln;
+			break;
+		case 'd':
+			insertLines(&cw->map, o->ln - 1, o->lines, o->n);
+			free(o->lines);
+			o->lines = 0;
+			o->op = 'a', --o->ln;
+			break;
+		case 'c':
+			t = lineAt(cw->map, o->ln);
+			swap = *t, *t = o->lines[0], o->lines[0] = swap;
+			break;
+		case 'm':
+			moveLines(o->dest + 1, o->n, o->ln - 1);
+			i = o->ln, o->ln = o->dest + 1, o->dest = i - 1;
+			break;
+		case 'x':
+			t = lineAt(cw->map, o->ln);
+			swap = *t;
+			*t = *lineAt(cw->map, o->dest);
+			*lineAt(cw->map, o->dest) = swap;
+			break;
+		}
+	}
+
+// the first thing to redo is the last thing we undid
+	for (i = 0, j = r->nops - 1; i < j; ++i, --j)
+		swapop = r->ops[i], r->ops[i] = r->ops[j], r->ops[j] = swapop;
+
+	cw->dol = (cw->map ? cw->map->dol : 0);
+	i = r->dot, r->dot = cw->dot, cw->dot = i;
+	for (j = 0; j < MARKLETTERS; ++j)
+		i = r->labels[j], r->labels[j] = cw->labels[j], cw->labels[j] = i;
+}
+
+/* step is - to undo, + to redo, or 0 for u, which toggles */
+static bool undoStep(char step)
+{
+	struct undoRec *r, **from, **to;
+	if (!cw->undoable || undoOwner != cw) {
+		setError(MSG_NoUndo);
+		return false;
+	}
+	if (!step)
+		step = (undoLast == '-' ? '+' : '-');
+	from = (step == '-' ? &undoList : &redoList);
+	to = (step == '-' ? &redoList : &undoList);
+	if (!(r = *from)) {
+		setError(MSG_NoUndo);
+		return false;
+	}
+	undoApply(r);
+	*from = r->next;
+	r->next = *to;
+	*to = r;
+	undoDepth += (step == '-' ? -1 : 1);
+	undoLast = step;
+	return true;
+}
+
 static void freeWindow(Window *w)
 {
 	Frame *f, *fnext;
@@ -1037,6 +1697,9 @@ static void freeWindow(Window *w)
 	}
 	freeWindowLines(w->map);
 	freeWindowLines(w->r_map);
+	nzFree(w->fieldLines);
+	nzFree(w->lastrender);
+	closeSlab(w);
 	nzFree(w->htmltitle);
 	nzFree(w->htmldesc);
 	nzFree(w->htmlkey);
@@ -1199,21 +1862,15 @@ static struct lineMap *newpiece;
 static int *nextLabel(int *label);
 static void addToMap(int nlines, int destl)
 {
-	struct lineMap *newmap;
-	int svdol = cw->dol;
 	int *label = NULL;
 
 	if (nlines == 0)
 		i_printfExit(MSG_EmptyPiece);
 
-	if (sizeof(int) == 4) {
-		if (nlines > MAXLINES - cw->dol)
-			i_printfExit(MSG_LineLimit);
-	}
-
 /* browse has no undo command */
 	if (!(cw->browseMode | cw->dirMode))
 		undoPush();
+	undoLog('a', destl, nlines, 0);
 
 /* move the labels */
 	while ((label = nextLabel(label))) {
@@ -1223,22 +1880,7 @@ static void addToMap(int nlines, int destl)
 	cw->dot = destl + nlines;
 	cw->dol += nlines;
 
-	newmap = allocMem((cw->dol + 2) * LMSIZE);
-	if (destl)
-		memcpy(newmap, cw->map, (destl + 1) * LMSIZE);
-	else
-		memset(newmap, 0, LMSIZE);
-/* insert new piece here */
-	memcpy(newmap + destl + 1, newpiece, nlines * LMSIZE);
-/* put on the last piece */
-	if (destl < svdol)
-		memcpy(newmap + destl + nlines + 1, cw->map + destl + 1,
-		       (svdol - destl + 1) * LMSIZE);
-	else
-		memset(newmap + destl + nlines + 1, 0, LMSIZE);
-
-	nzFree(cw->map);
-	cw->map = newmap;
+	insertLines(&cw->map, destl, newpiece, nlines);
 	free(newpiece);
 	newpiece = 0;
 }
@@ -1246,20 +1888,16 @@ static void addToMap(int nlines, int destl)
 /* Add a block of text into the buffer; uses addToMap(). */
 bool addTextToBuffer(const pst inbuf, int length, int destl, bool showtrail)
 {
-	int i, j, linecount = 0;
+	int i, linecount = 0;
 	struct lineMap *t;
+	pst text;
 
 	if (!length)		// nothing to add
 		return true;
 
 	for (i = 0; i < length; ++i)
-		if (inbuf[i] == '\n') {
+		if (inbuf[i] == '\n')
 			++linecount;
-			if (sizeof(int) == 4) {
-				if (linecount + cw->dol > MAXLINES)
-					i_printfExit(MSG_LineLimit);
-			}
-		}
 
 	if (destl == cw->dol)
 		cw->nlMode = false;
@@ -1273,22 +1911,20 @@ bool addTextToBuffer(const pst inbuf, int length, int destl, bool showtrail)
 		}
 	}
 
+/* one copy of the text, into a slab, then point the lines into it */
+	text = (pst) slabSpace(cw, length + (inbuf[length - 1] != '\n'),
+			       linecount);
+	memcpy(text, inbuf, length);
+	if (inbuf[length - 1] != '\n')
+		text[length] = '\n';
+
 	newpiece = t = allocZeroMem(linecount * LMSIZE);
 	i = 0;
 	while (i < length) {	/* another line */
-		j = i;
+		t->text = text + i;
 		while (i < length)
 			if (inbuf[i++] == '\n')
 				break;
-		if (inbuf[i - 1] == '\n') {
-/* normal line */
-			t->text = allocMem(i - j);
-		} else {
-/* last line with no nl */
-			t->text = allocMem(i - j + 1);
-			t->text[i - j] = '\n';
-		}
-		memcpy(t->text, inbuf + j, i - j);
 		++t;
 	}			/* loop breaking inbuf into lines */
 
@@ -1402,19 +2038,29 @@ static void stripDotDot(char *path)
 
 static int *nextLabel(int *label)
 {
+	int *next;
+
 	if (label == NULL)
 		return cw->labels;
 
 	if (label >= cw->labels && label < cw->labels + MARKLETTERS - 1)
 		return label + 1;
 
+	if (label == &gNext)
+		return NULL;
+
 	/* first history label */
 	if (label == cw->labels + MARKLETTERS - 1)
-		return (int *)cw->histLabel;
-
+		next = (int *)cw->histLabel;
+	else
 	/* previous history label. */
 	/* in both case we rely on label being first element of the struct */
-	return (int *)((struct histLabel *)label)->prev;
+		next = (int *)((struct histLabel *)label)->prev;
+
+/* The g// cursor moves with the lines, like a label, while g// runs. */
+	if (!next && globSub)
+		next = &gNext;
+	return next;
 }
 
 /* Delete a block of text. */
@@ -1426,22 +2072,23 @@ void delText(int start, int end)
 /* browse has no undo command */
 	if (cw->browseMode | cw->sqlMode) {
 		for (ln = start; ln <= end; ++ln)
-			nzFree(cw->map[ln].text);
+			freeLineText(lineAt(cw->map, ln)->text);
+// no undoLog, but rerender has to know the buffer is not what it rendered
+		bufferChanged();
 	} else {
 		undoPush();
+		undoLog('d', start, end - start + 1, 0);
 	}
 
 	if (end == cw->dol)
 		cw->nlMode = false;
 	i = end - start + 1;
-	memmove(cw->map + start, cw->map + end + 1,
-		(cw->dol - end + 1) * LMSIZE);
+	removeLines(&cw->map, start, end);
 
 	if (cw->dirMode && cw->r_map) {
 // if you are looking at directories with ls-s or some such,
 // we have to delete the corresponding stat information.
-		memmove(cw->r_map + start, cw->r_map + end + 1,
-			(cw->dol - end + 1) * LMSIZE);
+		removeLines(&cw->r_map, start, end);
 	}
 
 /* move the labels */
@@ -1449,7 +2096,8 @@ void delText(int start, int end)
 		if ((ln = *label) < start)
 			continue;
 		if (ln <= end) {
-			*label = 0;
+/* a label goes away with its line, the g// cursor goes to the next line */
+			*label = (label == &gNext ? start : 0);
 			continue;
 		}
 		*label -= i;
@@ -1459,35 +2107,29 @@ void delText(int start, int end)
 	cw->dot = start;
 	if (cw->dot > cw->dol)
 		cw->dot = cw->dol;
-// by convention an empty buffer has no map
-	if (!cw->dol) {
-		free(cw->map);
-		cw->map = 0;
-		if (cw->dirMode && cw->r_map) {
-			free(cw->r_map);
-			cw->r_map = 0;
-		}
-	}
+// by convention an empty buffer has no map, and removeLines has seen to that
 }
 
 // for g/re/or v/re/d,     only for d,  only a text file
 // Algorithm is linear not quadratic.
 static void delTextG(void)
 {
-	int i, j;
+	int i, j, k;
 	int *label;
-	struct lineMap *t;
+	struct lineMap *t, *keep;
 
 // we wouldn't be here unless some lines match, so...
 	undoPush();
 
 // last line deleted?
-	t = cw->map + cw->dol;
+	t = lineAt(cw->map, cw->dol);
 	if (t->gflag)
 		cw->nlMode = false;
 
-	 t = cw->map + 1;
-	for(i = j = 1; i <= cw->dol; ++i, ++t) {
+// gather up the lines that remain, and build a new map from those
+	keep = allocMem(cw->dol * LMSIZE);
+	for(i = j = 1; i <= cw->dol; ++i) {
+		t = lineAt(cw->map, i);
 		label = NULL;
 		if(t->gflag) { // goodbye
 // did this line have a label?
@@ -1498,25 +2140,32 @@ static void delTextG(void)
 			continue;
 		}
 		if(i > j) {
-			cw->map[j] = *t;
 			while ((label = nextLabel(label)))
 				if(*label == i)
 					*label = j;
 		}
+		keep[j - 1] = *t;
 		++j;
 	}
 
-// map of lines has to null terminate
-	cw->map[j] = *t;
+// log the deleted runs for undo, bottom up, so the line numbers hold
+	for (i = cw->dol; i >= 1; i = k - 1) {
+		k = i;
+		if (!lineAt(cw->map, i)->gflag)
+			continue;
+		while (k > 1 && lineAt(cw->map, k - 1)->gflag)
+			--k;
+		undoLog('d', k, i - k + 1, 0);
+	}
+
+// by convention an empty buffer has no map, and newLineIndex honors that
+	freeLineIndex(cw->map);
+	cw->map = newLineIndex(keep, j - 1);
+	free(keep);
 
 	cw->dol = j - 1;
 	if (cw->dot > cw->dol)
 		cw->dot = cw->dol;
-// by convention an empty buffer has no map
-	if (!cw->dol) {
-		free(cw->map);
-		cw->map = 0;
-	}
 }
 
 /* Delete files from a directory as you delete lines.
@@ -1782,15 +2431,16 @@ moved:
 		addTextToBuffer((pst)file, t-file, dol, false);
 		free(file);
 		cw->dot = ++dol;
-		cw->map[dol].ds1 = ftype[0];
+		lineAt(cw->map, dol)->ds1 = ftype[0];
 		if(ftype[0])
-			cw->map[dol].ds2 = ftype[1];
+			lineAt(cw->map, dol)->ds2 = ftype[1];
 // if attributes were displayed in that directory - more work to do.
 // I just leave a space for them; I don't try to derive them.
 		if(cw->r_map) {
-			cw->r_map = reallocMem(cw->r_map, LMSIZE * (dol + 2));
-			memset(cw->r_map + dol, 0, LMSIZE*2);
-			cw->r_map[dol].text = (uchar*)emptyString;
+			struct lineMap blank;
+			memset(&blank, 0, LMSIZE);
+			blank.text = (uchar*)emptyString;
+			insertLines(&cw->r_map, dol - 1, &blank, 1);
 		}
 		cw = cw1; // put it back
 	}
@@ -1805,12 +2455,8 @@ static bool moveCopy(void)
 	int sr = startRange;
 	int er = endRange + 1;
 	int dl = destLine + 1;
-	int i_sr = sr * LMSIZE;	/* indexes into map */
-	int i_er = er * LMSIZE;
-	int i_dl = dl * LMSIZE;
 	int n_lines = er - sr;
-	struct lineMap *map = cw->map;
-	struct lineMap *newmap, *t;
+	struct lineMap *t;
 	int lowcut, highcut, diff, i, ln;
 	int *label = NULL;
 
@@ -1841,18 +2487,11 @@ static bool moveCopy(void)
 	if (destLine == cw->dol || endRange == cw->dol)
 		cw->nlMode = false;
 
-/* All we really need do is rearrange the map. */
-	newmap = allocMem((cw->dol + 2) * LMSIZE);
-	memcpy(newmap, map, (cw->dol + 2) * LMSIZE);
-	if (dl < sr) {
-		memcpy(newmap + dl, map + sr, i_er - i_sr);
-		memcpy(newmap + dl + er - sr, map + dl, i_sr - i_dl);
-	} else {
-		memcpy(newmap + sr, map + er, i_dl - i_er);
-		memcpy(newmap + sr + dl - er, map + sr, i_er - i_sr);
-	}
-	free(cw->map);
-	cw->map = newmap;
+/* All we really need do is rearrange the map.
+ * Lift the block out, then drop it in after the destination line,
+ * which has moved up if it was below the block. */
+	undoLog('m', sr, n_lines, (dl < sr ? destLine : destLine - n_lines));
+	moveLines(sr, n_lines, (dl < sr ? destLine : destLine - n_lines));
 
 /* now for the labels */
 	if (dl < sr) {
@@ -1871,7 +2510,11 @@ static bool moveCopy(void)
 		if (ln >= highcut)
 			continue;
 		if (ln >= startRange && ln <= endRange) {
-			ln += (dl < sr ? -diff : diff);
+/* The g// cursor doesn't go with the block, it goes to the line after. */
+			if (label == &gNext)
+				ln = (dl < sr ? er : sr);
+			else
+				ln += (dl < sr ? -diff : diff);
 		} else {
 			ln += (dl < sr ? n_lines : -n_lines);
 		}
@@ -2132,7 +2775,11 @@ static bool readDirectory(const char *filename)
 	}
 
 	addToMap(linecount, endRange);
-	cw->r_map = backpiece;
+	cw->r_map = 0;
+	if (backpiece) {
+		cw->r_map = newLineIndex(backpiece + 1, linecount);
+		free(backpiece);
+	}
 
 success:
 	if (cmd == 'r')
@@ -2142,6 +2789,276 @@ success:
 
 /* Read a file, or url, into the current buffer.
  * Post/get data is passed, via the second parameter, if it's a URL. */
+/*********************************************************************
+em file is e file, but the file is mapped into memory,
+and the lines of the buffer point right into the mapping.
+Nothing is read or copied up front; pages come in as they are touched,
+so a huge log is ready to search almost at once,
+and the text costs nothing beyond the page cache.
+The mapping is private, writing to a page makes a copy of that page,
+so nothing goes back to the file unless you w it, as always.
+The bytes come in as they are, with no crlf or charset conversion,
+and the binary check looks only at the start of the file.
+If another program truncates the file while it is mapped,
+touching the lost pages kills edbrowse, so use this on files that sit still,
+or only grow, which is most logs.
+em on a url, a directory, or anything else that is not a regular file,
+is just e.
+*********************************************************************/
+
+static bool mapRead;		/* this is em, not e */
+
+#ifndef DOSLIKE
+#define MAPBINCHECK 0x10000
+
+static bool readFileMapped(const char *filename)
+{
+	int fd, nlines = 0, cap;
+	struct stat st;
+	char *base, *s, *end, *nl;
+	struct textSlab *sl;
+	struct lineMap *t;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		setError(MSG_NoOpen, filename);
+		return false;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		setError(MSG_NoRead2, filename);
+		return false;
+	}
+	base = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		setError(MSG_NoRead2, filename);
+		return false;
+	}
+	end = base + st.st_size;
+	madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+	if (binaryDetect && !cw->binMode &&
+	    looksBinary((uchar *) base,
+			(st.st_size < MAPBINCHECK ? st.st_size : MAPBINCHECK))) {
+		if (debugLevel >= 1)
+			i_puts(MSG_BinaryData);
+		cw->binMode = true;
+	}
+
+	cap = st.st_size / 32 + 16;
+	newpiece = t = allocZeroMem(cap * LMSIZE);
+	for (s = base; s < end; s = nl + 1) {
+		if (nlines == cap) {
+			cap = cap / 2 * 3;
+			newpiece = reallocMem(newpiece, cap * LMSIZE);
+		}
+		t = newpiece + nlines++;
+		memset(t, 0, LMSIZE);
+		nl = memchr(s, '\n', end - s);
+		if (nl) {
+			t->text = (pst) s;
+			continue;
+		}
+/* last line doesn't end in newline, it has to be copied */
+		t->text = (pst) slabSpace(cw, end - s + 1, 1);
+		memcpy(t->text, s, end - s);
+		t->text[end - s] = '\n';
+		cw->nlMode = true;
+		if (!cw->binMode)
+			i_puts(MSG_NoTrailing);
+		break;
+	}
+	madvise(base, st.st_size, MADV_NORMAL);
+
+	if (nlines > cw->nlMode) {
+		sl = addSlab(base, st.st_size);
+		sl->mapped = true;
+		sl->dev = st.st_dev, sl->ino = st.st_ino;
+		sl->used = st.st_size;
+		sl->refs = nlines - cw->nlMode;
+	} else			// one line and no newline, nothing points into the map
+		munmap(base, st.st_size);
+
+	addToMap(nlines, 0);
+	if (st.st_size > INT_MAX) {
+		debugPrint(1, "%lld", (long long)st.st_size);
+		fileSize = -1;
+	} else
+		fileSize = st.st_size;
+// serverData doesn't mean anything here, but it has to be not null
+	serverData = emptyString;
+	return true;
+}
+
+/*********************************************************************
+A large web page was spilled to a temp file, rather than held in memory;
+see spillBody() in http.c.
+If it is plain text, as we would store it, no byte order mark,
+no crlf to strip, nothing to convert between 8859 and utf8,
+then map it into the buffer, as em would, and memory stays bounded.
+A page that is going to be browsed, canmap = false, is always read
+into memory, since the html parser wants it there.
+Binary or text is judged on the first SPILLCHECK bytes, as a whole file is
+one or the other, but every chunk of text is looked at,
+and if any part of it would have to be converted,
+read it into memory and let readFile convert it as usual.
+No chunk 8859 means the whole file isn't 8859, by the ratios in
+looks_8859_utf8(), and the same for utf8.
+The file is unlinked either way; the mapping lives on without it.
+*********************************************************************/
+
+#define SPILLCHECK (1024*1024)
+
+/*********************************************************************
+Check one chunk of the spill file, at offset off.
+looks_8859_utf8 reads past a leading byte to its continuation bytes,
+so map a few bytes more than we judge, and at the end of the file,
+stop at the last ascii byte.
+Skip continuation bytes at the start, they belong to the previous chunk.
+Return true if the chunk is plain.
+*********************************************************************/
+
+static bool spillChunk(int fd, off_t off, off_t size,
+		       bool *is8859, bool *isutf8, bool *cr)
+{
+	uchar *base;
+	int n, m, i;
+	bool plain = true, iso, utf;
+
+	n = (size - off < SPILLCHECK + 8 ? size - off : SPILLCHECK + 8);
+	m = (n > SPILLCHECK ? SPILLCHECK : n);
+	base = mmap(0, n, PROT_READ, MAP_PRIVATE, fd, off);
+	if (base == MAP_FAILED)
+		return false;
+// \r at the end of the last chunk, \n at the start of this one
+	if (*cr && base[0] == '\n')
+		plain = false;
+	*cr = (base[m - 1] == '\r');
+	if (memmem(base, m, "\r\n", 2))
+		plain = false;
+	if (m == n)
+		while (m && (base[m - 1] & 0x80))
+			--m;
+	for (i = 0; i < m && i < 8 && (base[i] & 0xc0) == 0x80; ++i) ;
+	looks_8859_utf8(base + i, m - i, &iso, &utf);
+	if ((cons_utf8 && iso) || (!cons_utf8 && utf))
+		plain = false;
+	*is8859 |= iso, *isutf8 |= utf;
+	munmap(base, n);
+	return plain;
+}
+
+static bool readSpill(const char *filename, bool canmap, bool *mapped)
+{
+	int fd;
+	struct stat st;
+	uchar *base;
+	int n;
+	off_t off;
+	bool plain, is8859 = false, isutf8 = false, cr = false;
+
+	*mapped = false;
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		if (fd >= 0)
+			close(fd);
+		setError(MSG_NoOpen, filename);
+		return false;
+	}
+	n = (st.st_size < SPILLCHECK ? st.st_size : SPILLCHECK);
+	base = mmap(0, n, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		setError(MSG_NoRead2, filename);
+		return false;
+	}
+	plain = canmap;
+	if (plain && iuConvert && !looksBinary(base, n)) {
+		if (byteOrderMark(base, n))
+			plain = false;
+		if (n >= 3 && !memcmp(base, "\xef\xbb\xbf", 3))
+			plain = false;
+		for (off = 0; plain && off < st.st_size; off += SPILLCHECK)
+			plain = spillChunk(fd, off, st.st_size,
+					   &is8859, &isutf8, &cr);
+	}
+	munmap(base, n);
+	close(fd);
+
+	if (!plain) {
+		bool rc = fileIntoMemory(filename, &serverData, &serverDataLen);
+		unlink(filename);
+		return rc;
+	}
+
+	debugPrint(3, "text type is %s",
+		   (isutf8 ? "utf8" : (is8859 ? "8859" : "ascii")));
+	*mapped = readFileMapped(filename);
+	unlink(filename);
+	if (!*mapped)
+		return false;
+	if (isutf8) {
+		cw->utf8Mode = true;
+		debugPrint(3, "setting utf8 mode");
+	}
+	if (is8859) {
+		cw->iso8859Mode = true;
+		debugPrint(3, "setting 8859 mode");
+	}
+	return true;
+}
+
+/*********************************************************************
+Writing a file truncates it, and if em has that file mapped,
+the lines of the buffer vanish out from under us, or worse, SIGBUS.
+So before we write, copy the mapping into anonymous memory,
+at the same address, a chunk at a time, so no line has to move.
+The slab stays mapped, but it no longer has anything to do with the file.
+*********************************************************************/
+
+#define UNMAPCHUNK (1024*1024)
+
+static bool unmapFile(const char *filename)
+{
+	struct stat st;
+	struct textSlab *sl;
+	char *buf = 0, *p;
+	size_t off, n;
+	int j;
+
+	if (stat(filename, &st) < 0)
+		return true;
+	for (j = 0; j < slabCount; ++j) {
+		sl = slabList[j];
+		if (!sl->mapped || sl->dev != st.st_dev || sl->ino != st.st_ino)
+			continue;
+		debugPrint(3, "copy %zu mapped bytes out of %s", sl->size,
+			   filename);
+		if (!buf)
+			buf = allocMem(UNMAPCHUNK);
+		for (off = 0; off < sl->size; off += n) {
+			n = sl->size - off;
+			if (n > UNMAPCHUNK)
+				n = UNMAPCHUNK;
+			p = sl->base + off;
+			memcpy(buf, p, n);
+			if (mmap(p, n, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1,
+				 0) == MAP_FAILED) {
+				free(buf);
+				setError(MSG_NoCreate2, filename);
+				return false;
+			}
+			memcpy(p, buf, n);
+		}
+		sl->dev = 0, sl->ino = 0;
+	}
+	nzFree(buf);
+	return true;
+}
+#endif
+
 static bool readFile(const char *filename, bool newwin,
 		     int fromframe, const char *fromthis, const char *orig_head)
 {
@@ -2209,6 +3126,11 @@ static bool readFile(const char *filename, bool newwin,
 		g.url = filename;
 		g.thisfile = fromthis;
 		g.custom_h = orig_head;
+#ifndef DOSLIKE
+// a large page can go to a temp file, see readSpill()
+		if (newwin && !fromframe && (cmd == 'e' || cmd == 'b'))
+			g.spill_ok = true;
+#endif
 		rc = httpConnect(&g);
 		serverData = g.buffer;
 		serverDataLen = g.length;
@@ -2226,16 +3148,35 @@ static bool readFile(const char *filename, bool newwin,
 
 /* We got some data.  Any warnings along the way have been printed,
  * like 404 file not found, but it's still worth continuing. */
-		rbuf = serverData;
-		fileSize = readSize = serverDataLen;
 		if (g.code != 200 && g.code != 210)
 			cf->render1 = cf->render2 = true;
+		if (g.csp) {
+			cf->mt = 0;
+			cf->render1 = cf->render2 = true;
+		}
 
 // Don't print "this doesn't look like browsable text"
 // if the content type is plain text.
 		if (memEqualCI(g.content, "text/plain", 10) && cmd == 'b')
 			cmd = 'e';
 
+#ifndef DOSLIKE
+// A spilled page that could be mapped is already in the buffer.
+// A page to browse is parsed from memory, so it is read back in.
+		if (g.spill_file) {
+			bool mapped;
+			nzFree(serverData);
+			serverData = 0;
+			rc = readSpill(g.spill_file, (cmd == 'e'), &mapped);
+			free(g.spill_file);
+			if (!rc || mapped)
+				return rc;
+		}
+#endif
+
+		rbuf = serverData;
+		fileSize = readSize = serverDataLen;
+
 		if (fileSize == 0) {	/* empty file */
 			nzFree(rbuf);
 			if (!fromframe)
@@ -2243,10 +3184,6 @@ static bool readFile(const char *filename, bool newwin,
 			return true;
 		}
 
-		if (g.csp) {
-			cf->mt = 0;
-			cf->render1 = cf->render2 = true;
-		}
 // acid says a frame has to be text/html, not even text/plain.
 		if (fromframe && g.content[0]
 		    && !stringEqual(g.content, "text/html")) {
@@ -2369,6 +3306,15 @@ badfile:
 	if (newwin && !fileprot && !cf->mt)
 		cf->mt = findMimeByFile(filename);
 
+#ifndef DOSLIKE
+	if (mapRead && filetype == 'f' && newwin && !fromframe && !cw->dol) {
+		struct stat st;
+		mapRead = false;
+		if (!stat(filename, &st) && st.st_size)
+			return readFileMapped(filename);
+	}
+#endif
+
 // Optimize; don't read a file into buffer if you're
 // just going to process it.
 	if (cf->mt && cf->mt->outtype && pluginsOn && !access(filename, 4)
@@ -2622,6 +3568,12 @@ static bool writeFile(const char *name, int mode)
 	if (cw->binMode | cw->utf16Mode | cw->utf32Mode)
 		stringAndChar(&modeString, &modeString_l, 'b');
 
+#ifndef DOSLIKE
+	if (!(mode & O_APPEND) && !unmapFile(name)) {
+		nzFree(modeString);
+		return false;
+	}
+#endif
 	fh = fopen(name, modeString);
 	nzFree(modeString);
 	if (fh == NULL) {
@@ -2750,7 +3702,7 @@ badline:
 			if (len && fwrite(suf, len, 1, fh) <= 0)
 				goto badline;
 			++len;	/* for nl */
-			extra = (char *)cw->r_map[i].text;
+			extra = (char *)lineAt(cw->r_map, i)->text;
 			l = strlen(extra);
 			if (l) {
 				if (fwrite(" ", 1, 1, fh) <= 0)
@@ -2818,7 +3770,7 @@ if(readLine1 < 0)
 			char *suf = dirSuffixContext(i, cx);
 			char *q;
 			if (lw->r_map) {
-				char *extra = (char *)lw->r_map[i].text;
+				char *extra = (char *)lineAt(lw->r_map, i)->text;
 				int elen = strlen(extra);
 				q = allocMem(len + 4 + elen);
 				memcpy(q, p, len);
@@ -2893,7 +3845,7 @@ static bool writeContext(int cx, int writeLine)
 			char *q;
 			char *suf = dirSuffix(i);
 			if (cw->r_map) {
-				char *extra = (char *)cw->r_map[i].text;
+				char *extra = (char *)lineAt(cw->r_map, i)->text;
 				int elen = strlen(extra);
 				q = allocMem(len + 4 + elen);
 				memcpy(q, p, len);
@@ -3352,6 +4304,78 @@ static pcre2_match_data *match_data;
 static pcre2_code *re_cc;	/* compiled */
 bool re_utf8 = true;
 
+/*********************************************************************
+Compiled expressions are kept in a small cache, least recently used
+goes out first, keyed on the expression and the options,
+which carry case insensitivity and utf8.
+Typing n, or the same /re/ again, or running s/re/ under g/re/,
+doesn't compile anything.
+Each entry owns its match data; re_cc and match_data point into
+the cache, so callers never free them.
+The expression is also compiled by the jit if pcre2 has one,
+and pcre2_match runs the jit code when it is there,
+and the interpreter when it is not.
+*********************************************************************/
+
+#define RECACHESIZE 8
+static struct reCache {
+	char *re;
+	int opt;
+	unsigned stamp;
+	pcre2_code *cc;
+	pcre2_match_data *md;
+} re_cache[RECACHESIZE];
+static unsigned re_stamp;
+static pcre2_match_context *re_mc;
+static pcre2_jit_stack *re_js;
+
+static bool regexpCached(const char *re, int re_opt)
+{
+	struct reCache *c;
+	for (c = re_cache; c < re_cache + RECACHESIZE; ++c) {
+		if (!c->cc || c->opt != re_opt || !stringEqual(c->re, re))
+			continue;
+		c->stamp = ++re_stamp;
+		re_cc = c->cc;
+		match_data = c->md;
+		debugPrint(7, "regexp cache hit %s", re);
+		return true;
+	}
+	return false;
+}
+
+static void regexpToCache(const char *re, int re_opt)
+{
+	struct reCache *c, *old = re_cache;
+	for (c = re_cache; c < re_cache + RECACHESIZE; ++c) {
+		if (!c->cc) {
+			old = c;
+			break;
+		}
+		if (c->stamp < old->stamp)
+			old = c;
+	}
+	if (old->cc) {
+		pcre2_match_data_free(old->md);
+		pcre2_code_free(old->cc);
+		nzFree(old->re);
+	}
+// a larger jit stack than the default 32K, for big lines and hard patterns
+	if (!re_mc) {
+		re_mc = pcre2_match_context_create(NULL);
+		re_js = pcre2_jit_stack_create(32 * 1024, 1024 * 1024, NULL);
+		if (re_js)
+			pcre2_jit_stack_assign(re_mc, NULL, re_js);
+	}
+	if (pcre2_jit_compile(re_cc, PCRE2_JIT_COMPLETE))
+		debugPrint(7, "no jit for %s", re);
+	old->re = cloneString(re);
+	old->opt = re_opt;
+	old->stamp = ++re_stamp;
+	old->cc = re_cc;
+	old->md = match_data;
+}
+
 static void regexpCompile(const char *re, bool ci)
 {
 	static signed char try8 = 0;	/* 1 is utf8 on, -1 is utf8 off */
@@ -3379,6 +4403,9 @@ top:
 		}
 	}
 
+	if (regexpCached(re, re_opt))
+		return;
+
 	re_cc = pcre2_compile((uchar*)re, PCRE2_ZERO_TERMINATED, re_opt, &re_error, &re_offset, 0);
 	if (!re_cc && try8 > 0 && re_error == PCRE2_ERROR_UTF_IS_DISABLED) {
 		i_puts(MSG_PcreUtf8);
@@ -3391,9 +4418,196 @@ top:
 
 	if (!re_cc)
 		setError(MSG_RexpError, "ERROR");
-	else
+	else {
 // re_cc and match_data rise and fall together.
 		match_data = pcre2_match_data_create_from_pattern(re_cc, NULL);
+		regexpToCache(re, re_opt);
+	}
+}
+
+/*********************************************************************
+Matching a regular expression against every line of a big buffer,
+as g// does, or against every line up to the first hit, as /re/ does,
+is spread across threads, one per cpu.
+The lines to scan are numbered by position, 1 through n, in the order
+they would be looked at, which wraps around the end of the buffer
+for a search, and each thread takes a contiguous run of positions.
+The compiled pattern is shared; each thread has its own match data.
+For g//, each thread marks its own lines and counts them.
+For a search, the earliest hit wins, and a thread quits when
+another thread has found something before where it is looking.
+A line that pcre can't handle, bad utf8, stops the scan as it always has,
+and the earliest such line is reported.
+Small scans aren't worth the threads, and run the old way.
+*********************************************************************/
+
+#define PARALLELLINES 100000
+#define MAXSCANTHREADS 16
+
+struct reScan {
+	struct lineIndex *x;
+	int dol, base, incr;	/* position p is line base + incr*p, wrapped */
+	int p1, p2;		/* positions for this thread */
+	bool browsing, unmatch;
+	bool first;		/* stop at the first hit, as in a search */
+	int hit, err;		/* first hit, first error, as positions */
+	int count;		/* lines marked */
+	pthread_t tid;
+};
+
+static pthread_mutex_t scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int scan_best;		/* earliest hit or error found so far */
+
+static bool scanPassed(int p)
+{
+	bool rc;
+	pthread_mutex_lock(&scan_mutex);
+	rc = (scan_best && scan_best < p);
+	pthread_mutex_unlock(&scan_mutex);
+	return rc;
+}
+
+static void scanFound(int p)
+{
+	pthread_mutex_lock(&scan_mutex);
+	if (!scan_best || p < scan_best)
+		scan_best = p;
+	pthread_mutex_unlock(&scan_mutex);
+}
+
+static int scanLine(const struct reScan *r, int p)
+{
+	int ln = (r->base - 1 + r->incr * p) % r->dol;
+	if (ln < 0)
+		ln += r->dol;
+	return ln + 1;
+}
+
+static void *reScanThread(void *arg)
+{
+	struct reScan *r = arg;
+	pcre2_match_data *md = pcre2_match_data_create_from_pattern(re_cc, NULL);
+	pcre2_match_context *mc = pcre2_match_context_create(NULL);
+	pcre2_jit_stack *js = pcre2_jit_stack_create(32 * 1024, 1024 * 1024, NULL);
+	struct lineMap *t, *span = 0;
+	int p, ln, lo = 1, hi = 0, rc;
+	char *subject;
+
+	if (js)
+		pcre2_jit_stack_assign(mc, NULL, js);
+	for (p = r->p1; p <= r->p2; ++p) {
+		if (r->first && !(p & 1023) && scanPassed(p))
+			break;
+		ln = scanLine(r, p);
+		if (ln < lo || ln > hi)
+			span = lineSpan(r->x, ln, &lo, &hi);
+		t = span + (ln - lo);
+		subject = (char *)t->text;
+		if (r->browsing) {
+			subject = (char *)clonePstring(t->text);
+			removeHiddenNumbers((pst) subject, '\n');
+		}
+		rc = pcre2_match(re_cc, (uchar *) subject,
+				 pstLength((pst) subject) - 1, 0, 0, md, mc);
+		if (r->browsing)
+			free(subject);
+		if (rc < -1 && pcre_utf8_error_stop) {
+			r->err = p;
+			if (r->first)
+				scanFound(p);
+			break;
+		}
+		if ((rc >= 0) ^ r->unmatch) {
+			if (r->first) {
+				r->hit = p;
+				scanFound(p);
+				break;
+			}
+			t->gflag = true;
+			++r->count;
+		}
+	}
+
+	pcre2_match_data_free(md);
+	pcre2_match_context_free(mc);
+	if (js)
+		pcre2_jit_stack_free(js);
+	return NULL;
+}
+
+static int scanThreads(int n)
+{
+	static int ncpu;
+	if (!ncpu) {
+#ifdef DOSLIKE
+		ncpu = 1;
+#else
+		long k = sysconf(_SC_NPROCESSORS_ONLN);
+		ncpu = (k < 1 ? 1 : k > MAXSCANTHREADS ? MAXSCANTHREADS : k);
+#endif
+	}
+	return (n >= PARALLELLINES ? ncpu : 1);
+}
+
+/*********************************************************************
+Scan n positions of the current buffer with the compiled re_cc,
+starting after line base and moving by incr.
+Returns false if the scan is too small for threads,
+and the caller should do it the usual way.
+Otherwise *hit is the first line that matches, for a search,
+*err is the first line that pcre choked on, and *count is the number
+of lines marked, for g//.  Each is 0 if there is none.
+*********************************************************************/
+
+static bool reScanParallel(int base, int incr, int n, bool unmatch,
+			   bool first, int *hit, int *err, int *count)
+{
+	struct reScan r[MAXSCANTHREADS];
+	int nt = scanThreads(n), i, per;
+
+	if (nt < 2)
+		return false;
+	debugPrint(4, "scan %d lines in %d threads", n, nt);
+	scan_best = 0;
+	per = (n + nt - 1) / nt;
+	for (i = 0; i < nt; ++i) {
+		memset(r + i, 0, sizeof(struct reScan));
+		r[i].x = cw->map;
+		r[i].dol = cw->dol;
+		r[i].base = base, r[i].incr = incr;
+		r[i].p1 = i * per + 1;
+		r[i].p2 = (i + 1) * per;
+		if (r[i].p2 > n)
+			r[i].p2 = n;
+		r[i].browsing = cw->browseMode;
+		r[i].unmatch = unmatch, r[i].first = first;
+	}
+
+// the map isn't changing under us, so the threads only read it
+	for (i = 1; i < nt; ++i)
+		if (pthread_create(&r[i].tid, NULL, reScanThread, r + i))
+			reScanThread(r + i), r[i].tid = 0;
+	reScanThread(r);
+	for (i = 1; i < nt; ++i)
+		if (r[i].tid)
+			pthread_join(r[i].tid, NULL);
+
+	*hit = *err = *count = 0;
+	for (i = 0; i < nt; ++i) {
+		*count += r[i].count;
+		if (r[i].err && (!*err || r[i].err < *err))
+			*err = r[i].err;
+		if (r[i].hit && (!*hit || r[i].hit < *hit))
+			*hit = r[i].hit;
+	}
+// an error before the first hit stops a search
+	if (first && *hit && *err && *err < *hit)
+		*hit = 0;
+	if (*hit)
+		*hit = scanLine(r, *hit);
+	if (*err)
+		*err = scanLine(r, *err);
+	return true;
 }
 
 /* Get the start or end of a range.
@@ -3426,6 +4640,7 @@ const char **split)
 		bool ci = caseInsensitive;
 		bool unmatch = false;
 		bool forget = false;
+		int n, hit, err;
 		signed char incr;	/* forward or back */
 /* Don't look through an empty buffer. */
 		if (cw->dol == 0) {
@@ -3459,16 +4674,28 @@ const char **split)
 		regexpCompile(re, ci);
 		if (!re_cc)
 			return false;
-/* We should probably study the pattern, if the file is large.
- * But then again, it's probably not worth it,
- * since the expressions are simple, and the lines are short. */
 		incr = (first == '/' ? 1 : -1);
+		n = (searchWrap ? cw->dol :
+		     incr > 0 ? cw->dol - cw->dot : cw->dot - 1);
+		if (reScanParallel(cw->dot, incr, n, unmatch, true,
+				   &hit, &err, &n)) {
+			if (hit) {
+				ln = hit;
+				goto found;
+			}
+			if (err) {
+				setError(MSG_RexpError2, err);
+				return (globSub = false);
+			}
+			setError(MSG_NotFound);
+			return false;
+		}
 		while (true) {
 			char *subject;
+			int sublen;
+			bool copied;
 			ln += incr;
 			if (!searchWrap && (ln == 0 || ln > cw->dol)) {
-				pcre2_match_data_free(match_data);
-				pcre2_code_free(re_cc);
 				setError(MSG_NotFound);
 				return false;
 			}
@@ -3476,35 +4703,30 @@ const char **split)
 				ln = 1;
 			if (ln == 0)
 				ln = cw->dol;
-			subject = (char *)fetchLine(ln, 1);
+			subject = (char *)lineView(ln, &sublen, &copied);
 			re_count =
-			    pcre2_match(re_cc, (uchar*)subject,
-				      pstLength((pst) subject) - 1, 0, 0,
-				      match_data, NULL);
+			    pcre2_match(re_cc, (uchar*)subject, sublen, 0, 0,
+				      match_data, re_mc);
 //  {uchar snork[300]; pcre2_get_error_message(re_count, snork, 300); puts(snork); }
 			re_vector = pcre2_get_ovector_pointer(match_data);
-			free(subject);
+			if (copied)
+				free(subject);
 // An error in evaluation is treated like text not found.
 // This usually happens because this particular line has bad binary, not utf8.
 			if (re_count < -1 && pcre_utf8_error_stop) {
-				pcre2_match_data_free(match_data);
-				pcre2_code_free(re_cc);
 				setError(MSG_RexpError2, ln);
 				return (globSub = false);
 			}
 			if ((re_count >= 0) ^ unmatch)
 				break;
 			if (ln == cw->dot) {
-				pcre2_match_data_free(match_data);
-				pcre2_code_free(re_cc);
 				setError(MSG_NotFound);
 				return false;
 			}
 		}		/* loop over lines */
-		pcre2_match_data_free(match_data);
-		pcre2_code_free(re_cc);
 /* and ln is the line that matches */
 	}
+found:
 	/* Now add or subtract from this number */
 	while ((first = *line) == '+' || first == '-') {
 		int add = 1;
@@ -3560,7 +4782,7 @@ static bool doGlobal(const char *line)
 	char delim = *line;
 	struct lineMap *t;
 	char *re;		/* regular expression */
-	int i, origdot, yesdot, nodot;
+	int i, err, origdot, yesdot, nodot;
 
 	if (!delim) {
 		setError(MSG_RexpMissing, icmd);
@@ -3593,35 +4815,42 @@ static bool doGlobal(const char *line)
 /* clean up any previous global flags.
  * Also get ready for javascript, as in g/<->/ i=+
  * which I use in web based gmail to clear out spam etc. */
-	for (t = cw->map + 1; t->text; ++t)
-		t->gflag = false;
+	for (i = 1; i <= cw->dol; ++i)
+		lineAt(cw->map, i)->gflag = false;
 
 /* Find the lines that match the pattern. */
 	regexpCompile(re, ci);
 	if (!re_cc)
 		return false;
-	for (i = startRange; i <= endRange; ++i) {
-		char *subject = (char *)fetchLine(i, 1);
-		re_count =
-		    pcre2_match(re_cc, (uchar*)subject, pstLength((pst) subject) - 1,
-			      0, 0, match_data, NULL);
-		re_vector = pcre2_get_ovector_pointer(match_data);
-
-		free(subject);
-		if (re_count < -1 && pcre_utf8_error_stop) {
-  			pcre2_match_data_free(match_data);
-			pcre2_code_free(re_cc);
-			setError(MSG_RexpError2, i);
+	if (reScanParallel(startRange - 1, 1, endRange - startRange + 1,
+			   (cmd == 'v'), false, &i, &err, &gcnt)) {
+		if (err) {
+			setError(MSG_RexpError2, err);
 			return false;
 		}
-		if ((re_count < 0 && cmd == 'v')
-		    || (re_count >= 0 && cmd == 'g')) {
-			++gcnt;
-			cw->map[i].gflag = true;
-		}
-	}			/* loop over line */
-	pcre2_match_data_free(match_data);
-	pcre2_code_free(re_cc);
+	} else {
+		for (i = startRange; i <= endRange; ++i) {
+			int sublen;
+			bool copied;
+			char *subject = (char *)lineView(i, &sublen, &copied);
+			re_count =
+			    pcre2_match(re_cc, (uchar*)subject, sublen,
+				      0, 0, match_data, re_mc);
+			re_vector = pcre2_get_ovector_pointer(match_data);
+
+			if (copied)
+				free(subject);
+			if (re_count < -1 && pcre_utf8_error_stop) {
+				setError(MSG_RexpError2, i);
+				return false;
+			}
+			if ((re_count < 0 && cmd == 'v')
+			    || (re_count >= 0 && cmd == 'g')) {
+				++gcnt;
+				lineAt(cw->map, i)->gflag = true;
+			}
+		}		/* loop over line */
+	}
 
 	if (!gcnt) {
 		setError((cmd == 'v') + MSG_NoMatchG);
@@ -3643,12 +4872,22 @@ static bool doGlobal(const char *line)
 		line = "p";
 	origdot = cw->dot;
 	yesdot = nodot = 0;
+/*********************************************************************
+One pass from top to bottom does it.
+gNext, the next line to look at, is adjusted along with the labels
+as the subcommand adds, deletes, or moves lines,
+so lines added after the current line are skipped over,
+and if the current line is deleted we pick up at the line that follows.
+Only if a subcommand moves marked lines above the cursor
+do we need another pass.
+*********************************************************************/
 	change = true;
 	while (gcnt && change) {
-		change = false;	/* kinda like bubble sort */
-		for (i = 1; i <= cw->dol; ++i) {
-			int i2 = i;
-			t = cw->map + i;
+		change = false;
+		gNext = 1;
+		while (gNext <= cw->dol) {
+			i = gNext++;
+			t = lineAt(cw->map, i);
 			if (!t->gflag)
 				continue;
 			if (intFlag)
@@ -3656,14 +4895,11 @@ static bool doGlobal(const char *line)
 			change = true, --gcnt;
 			t->gflag = false;
 			cw->dot = i;	/* so we can run the command at this line */
-			if (runCommand(line)) {
+			if (runCommand(line))
 				yesdot = cw->dot;
-/* try this line again, in case we deleted or moved it somewhere else */
-				--i;
-			}
 // error in subcommand might turn global flag off
 			if (!globSub) {
-				nodot = i2, yesdot = 0;
+				nodot = i, yesdot = 0;
 				goto done;
 			}
 		}		/* loop over lines */
@@ -3671,6 +4907,7 @@ static bool doGlobal(const char *line)
 
 done:
 	globSub = false;
+	gNext = 0;
 /* yesdot could be 0, even on success, if all lines are deleted via g/re/d */
 	if (yesdot || !cw->dol) {
 		cw->dot = yesdot;
@@ -3731,7 +4968,7 @@ replaceText(const char *line, int len, const char *rhs,
 	while (true) {
 /* find the next match */
 		re_count =
-		    pcre2_match(re_cc, (uchar*)line, len, offset, 0, match_data, NULL);
+		    pcre2_match(re_cc, (uchar*)line, len, offset, 0, match_data, re_mc);
 		re_vector = pcre2_get_ovector_pointer(match_data);
 		if (re_count < -1 &&
 		    (pcre_utf8_error_stop || startRange == endRange)) {
@@ -4340,9 +5577,10 @@ static int substituteText(const char *line)
 			if (!linecount) {
 /* normal substitute */
 				undoPush();
-				mptr = cw->map + ln;
+				undoLog('c', ln, 0, 0);
+				mptr = lineAt(cw->map, ln);
 				if(cw->sqlMode)
-					nzFree(mptr->text);
+					freeLineText(mptr->text);
 				mptr->text = allocMem(replaceStringLength + 1);
 				memcpy(mptr->text, replaceString,
 				       replaceStringLength + 1);
@@ -4378,11 +5616,6 @@ static int substituteText(const char *line)
 		breakLineResult = 0;
 	}			// loop over lines in the range
 
-	if (re_cc) {
-		pcre2_match_data_free(match_data);
-		pcre2_code_free(re_cc);
-	}
-
 	if (intFlag) {
 		setError(MSG_Interrupted);
 		return -1;
@@ -4401,10 +5634,6 @@ static int substituteText(const char *line)
 	return true;
 
 abort:
-	if (re_cc) {
-		pcre2_match_data_free(match_data);
-		pcre2_code_free(re_cc);
-	}
 	nzFree(replaceString);
 /* we may have just freed the result of a breakline command */
 	breakLineResult = 0;
@@ -4425,6 +5654,7 @@ static char *allocatedLine = 0;
 /*********************************************************************
 Uses of allocatedLine:
 rf sets allocatedLine to b currentFile
+em file becomes e file, and the file is mapped, see readFileMapped()
 f/  becomes  f lastComponent
 w/  becomes  w lastComponent
 g becomes b url  (going to a hyperlink)
@@ -4823,6 +6053,14 @@ pwd:
 		return 2;
 	}
 
+	if (!strncmp(line, "em ", 3) && line[3]) {
+		mapRead = true;
+		allocatedLine = allocMem(strlen(line));
+		sprintf(allocatedLine, "e %s", line + 3);
+		*runThis = allocatedLine;
+		return 2;
+	}
+
 	if (stringEqual(line, "config")) {
 		readConfigFile();
 		setupEdbrowseCache();
@@ -4919,7 +6157,7 @@ pwd:
 et_go:
 			cw->f_dot = 0;
 			for (i = 1; i <= cw->dol; ++i)
-				removeHiddenNumbers(cw->map[i].text, '\n');
+				removeHiddenNumbers(lineAt(cw->map, i)->text, '\n');
 			freeWindowLines(cw->r_map);
 			cw->r_map = 0;
 		}
@@ -5822,7 +7060,7 @@ bool unfoldBufferW(const Window *w, bool cr, char **data, int *len)
 	buf = allocMem(size + 4);
 	*data = buf;
 	for (ln = 1; ln <= w->dol; ++ln) {
-		pst line = w->map[ln].text;
+		pst line = lineAt(w->map, ln)->text;
 		l = pstLength(line) - 1;
 		if (l) {
 			memcpy(buf, line, l);
@@ -6049,6 +7287,7 @@ bool runCommand(const char *line)
 	const Tag *tag = 0, *jumptag = 0;
 	bool nogo = true, rc = true;
 	bool emode = false;	// force e, not browse
+	char undoDir = 0;	// u- or u+
 	bool postSpace = false, didRange = false;
 	char first;
 	int cx = 0;		/* numeric suffix as in s/x/y/3 or w2 */
@@ -6084,6 +7323,7 @@ bool runCommand(const char *line)
 
 	if (!globSub) {
 		madeChanges = false;
+		undoOpen = 0;
 
 /* Watch for successive q commands. */
 		lastq = lastqq, lastqq = 0;
@@ -6095,6 +7335,7 @@ bool runCommand(const char *line)
 			noStack = true, line += 2, first = *line;
 
 /* special 2 letter commands - most of these change operational modes */
+		mapRead = false;
 		j = twoLetter(line, &line);
 		if (j != 2)
 			return j;
@@ -6512,7 +7753,7 @@ replaceframe:
 		p[len - 1] = 0;
 		undoSpecial = cloneString(p);
 		p[len - 1] = '\n';
-		mptr = cw->map + cw->dot;
+		mptr = lineAt(cw->map, cw->dot);
 		len = strlen(oldline);
 		oldline[len] = '\n';
 		mptr->text = (pst)oldline;
@@ -6661,6 +7902,10 @@ replaceframe:
 		linePending = 0;
 	}
 
+	/* u- and u+ step back and forth through the undo history */
+	if (cmd == 'u' && (stringEqual(line, "-") || stringEqual(line, "+")))
+		undoDir = *line, ++line, first = 0;
+
 	if (first && strchr(nofollow_cmd, cmd)) {
 		setError(MSG_TextAfter, icmd);
 		return (globSub = false);
@@ -6695,23 +7940,8 @@ replaceframe:
 		return balanceLine(line);
 	}
 
-	if (cmd == 'u') {
-		Window *uw = &undoWindow;
-		struct lineMap *swapmap;
-		if (!cw->undoable) {
-			setError(MSG_NoUndo);
-			return false;
-		}
-/* swap, so we can undo our undo, if need be */
-		i = uw->dot, uw->dot = cw->dot, cw->dot = i;
-		i = uw->dol, uw->dol = cw->dol, cw->dol = i;
-		for (j = 0; j < MARKLETTERS; ++j) {
-			i = uw->labels[j], uw->labels[j] =
-			    cw->labels[j], cw->labels[j] = i;
-		}
-		swapmap = uw->map, uw->map = cw->map, cw->map = swapmap;
-		return true;
-	}
+	if (cmd == 'u')
+		return undoStep(undoDir);
 
 	if (cmd == 'k') {
 		if (!islowerByte(first) || line[1]) {
@@ -7989,9 +9219,23 @@ bool browseCurrentBuffer(void)
 	return true;
 }
 
-bool locateTagInBuffer(int tagno, int *ln_p, char **p_p, char **s_p, char **t_p)
+/*********************************************************************
+Find input field tagno in the buffer.
+It is on the line with InternalCodeChar tagno < value InternalCodeChar 0 >.
+jSyncup asks this of every field on the page before every js event,
+and the answer use to be a scan of the buffer from line 1,
+fields times lines, and a form heavy page has a lot of both.
+Now one scan records the line of every field in cw->fieldLines,
+and that holds until lines are added to or removed from the buffer;
+each such change gives the map a new serial number.
+The line is still checked for the field, since a line can be replaced
+in place, and if the field isn't there the index is built again.
+*********************************************************************/
+
+/* Is the field on this line? Set the pointers if it is. */
+static bool tagOnLine(int tagno, int ln, char **p_p, char **s_p, char **t_p)
 {
-	int ln, n;
+	int n;
 	char *p, *s, *t, c;
 	char search[20];
 	char searchend[4];
@@ -7999,28 +9243,78 @@ bool locateTagInBuffer(int tagno, int *ln_p, char **p_p, char **s_p, char **t_p)
 	sprintf(search, "%c%d<", InternalCodeChar, tagno);
 	sprintf(searchend, "%c0>", InternalCodeChar);
 	n = strlen(search);
+	p = (char *)fetchLine(ln, -1);
+	for (s = p; (c = *s) != '\n'; ++s) {
+		if (c != InternalCodeChar)
+			continue;
+		if (!strncmp(s, search, n))
+			break;
+	}
+	if (c == '\n')
+		return false;
+	s = strchr(s, '<') + 1;
+	t = strstr(s, searchend);
+	if (!t)
+		i_printfExit(MSG_NoClosingLine, ln);
+	*p_p = p;
+	*s_p = s;
+	*t_p = t;
+	return true;
+}
+
+static void indexFields(void)
+{
+	int ln, tagno;
+	char *p, *s;
+
+	if (cw->fieldLines)
+		memset(cw->fieldLines, 0, cw->fieldMax * sizeof(int));
 	for (ln = 1; ln <= cw->dol; ++ln) {
 		p = (char *)fetchLine(ln, -1);
-		for (s = p; (c = *s) != '\n'; ++s) {
-			if (c != InternalCodeChar)
+		for (s = p; *s != '\n'; ++s) {
+			if (*s != InternalCodeChar || !isdigitByte(s[1]))
 				continue;
-			if (!strncmp(s, search, n))
-				break;
+			tagno = strtol(s + 1, &s, 10);
+			if (*s != '<' || !tagno) {
+				--s;
+				continue;
+			}
+			if (tagno >= cw->fieldMax) {
+				int m = tagno + 1 + cw->fieldMax / 2;
+				cw->fieldLines = (cw->fieldLines ?
+				    reallocMem(cw->fieldLines, m * sizeof(int)) :
+				    allocMem(m * sizeof(int)));
+				memset(cw->fieldLines + cw->fieldMax, 0,
+				       (m - cw->fieldMax) * sizeof(int));
+				cw->fieldMax = m;
+			}
+			cw->fieldLines[tagno] = ln;
 		}
-		if (c == '\n')
-			continue;	/* not here, try next line */
-		s = strchr(s, '<') + 1;
-		t = strstr(s, searchend);
-		if (!t)
-			i_printfExit(MSG_NoClosingLine, ln);
-		*ln_p = ln;
-		*p_p = p;
-		*s_p = s;
-		*t_p = t;
-		return true;
 	}
+	cw->fieldSerial = mapSerial(cw->map);
+	debugPrint(4, "field index over %d lines", cw->dol);
+}
 
-	return false;
+bool locateTagInBuffer(int tagno, int *ln_p, char **p_p, char **s_p, char **t_p)
+{
+	int ln;
+	bool rebuilt = false;
+
+	if (cw->fieldSerial != mapSerial(cw->map)) {
+		indexFields();
+		rebuilt = true;
+	}
+	while (true) {
+		ln = (tagno < cw->fieldMax ? cw->fieldLines[tagno] : 0);
+		if (ln && ln <= cw->dol && tagOnLine(tagno, ln, p_p, s_p, t_p)) {
+			*ln_p = ln;
+			return true;
+		}
+		if (rebuilt || !ln)
+			return false;
+		indexFields();
+		rebuilt = true;
+	}
 }
 
 char *getFieldFromBuffer(int tagno)
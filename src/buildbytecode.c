@@ -0,0 +1,128 @@
+/*********************************************************************
+Compile shared.js and startwindow.js into quick js bytecode,
+and write that bytecode out as C arrays, in the same manner as
+buildsourcestring.pl writes out the source.
+This runs at build time, on the strings in startwindow.o,
+so the bytecode is compiled from exactly the text edbrowse would parse.
+startwindow.js runs for every window and every frame,
+and reading bytecode skips the parser altogether.
+The arrays are empty if a script contains bp@( or trace@(,
+since those macros have to be expanded at run time;
+edbrowse then falls back on the source.
+-s leaves the arrays empty in any case, so you can build edbrowse
+on the source and time it against the bytecode.
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quickjs.h"
+
+extern const char sharedJS[];
+extern const char startWindowJS[];
+
+static FILE *outf;
+static int sourceOnly;
+
+static int writeBytecode(JSContext *cx, const char *src, const char *filename,
+			  const char *arrayname)
+{
+	JSValue fn;
+	uint8_t *bc = 0;
+	size_t i, len = 0;
+
+	if (sourceOnly) {
+		printf("%s, source only, bytecode omitted\n", filename);
+		goto write;
+	}
+	if (strstr(src, "bp@(") || strstr(src, "trace@(")) {
+		printf("%s has breakpoints, bytecode omitted\n", filename);
+		goto write;
+	}
+
+	fn = JS_Eval(cx, src, strlen(src), filename,
+		     JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+	if (JS_IsException(fn)) {
+		JSValue e = JS_GetException(cx);
+		const char *msg = JS_ToCString(cx, e);
+		fprintf(stderr, "%s: %s\n", filename, (msg ? msg : "syntax error"));
+		JS_FreeCString(cx, msg);
+		JS_FreeValue(cx, e);
+		return 0;
+	}
+	bc = JS_WriteObject(cx, &len, fn, JS_WRITE_OBJ_BYTECODE);
+	JS_FreeValue(cx, fn);
+	if (!bc) {
+		fprintf(stderr, "%s: cannot write bytecode\n", filename);
+		return 0;
+	}
+
+write:
+	fprintf(outf, "/* bytecode for %s */\n", filename);
+	fprintf(outf, "const unsigned char %s[] = {\n", arrayname);
+	for (i = 0; i < len; ++i) {
+		fprintf(outf, "0x%02x,", bc[i]);
+		if (i % 16 == 15)
+			fprintf(outf, "\n");
+	}
+	fprintf(outf, "0};\n");
+	fprintf(outf, "const size_t %s_len = %lu;\n\n", arrayname,
+		(unsigned long)len);
+	if (bc) {
+		js_free(cx, bc);
+		printf("Bytecode for %s, %lu bytes\n", filename,
+		       (unsigned long)len);
+	}
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	JSRuntime *rt;
+	JSContext *cx;
+	const char *outfile;
+	const char *outbase;
+
+	if (argc == 3 && !strcmp(argv[1], "-s")) {
+		sourceOnly = 1;
+		--argc, ++argv;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "Usage: buildbytecode [-s] outfile\n");
+		exit(1);
+	}
+	outfile = argv[1];
+	outbase = strrchr(outfile, '/');
+	outbase = (outbase ? outbase + 1 : outfile);
+
+	rt = JS_NewRuntime();
+	cx = (rt ? JS_NewContext(rt) : 0);
+	if (!cx) {
+		fprintf(stderr, "Cannot create javascript runtime environment\n");
+		exit(1);
+	}
+
+	outf = fopen(outfile, "w");
+	if (!outf) {
+		fprintf(stderr, "Error: Unable to create %s file!\n", outfile);
+		exit(1);
+	}
+	fprintf(outf, "/* %s: this file is machine generated; */\n\n", outbase);
+	fprintf(outf, "#include <stddef.h>\n\n");
+	if (!writeBytecode(cx, sharedJS, "shared.js", "sharedBC") ||
+	    !writeBytecode(cx, startWindowJS, "startwindow.js", "startWindowBC")) {
+		fclose(outf);
+		remove(outfile);
+		exit(1);
+	}
+	if (fclose(outf)) {
+		fprintf(stderr, "Error: Unable to write %s file!\n", outfile);
+		remove(outfile);
+		exit(1);
+	}
+
+	JS_FreeContext(cx);
+	JS_FreeRuntime(rt);
+	return 0;
+}
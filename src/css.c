@@ -10,6 +10,10 @@ which is a tad faster.
 
 #include "eb.h"
 
+#ifdef _MSC_VER
+extern int gettimeofday(struct timeval *tp, void *tzp);	// from tidys.lib
+#endif
+
 #define CSS_ERROR_NONE 0
 #define CSS_ERROR_NOSEL 1
 #define CSS_ERROR_MANYNOT 2
@@ -354,9 +358,33 @@ struct shortcache {
 	char *data;
 };
 
-struct cssmaster {
+// nodes by tag name, see tagIndexList()
+struct tagindex {
+	char *key;
+	Tag **body;
+	int n, a;
+};
+
+// A parsed style sheet, shared by every frame that uses it; see cssSheets()
+struct cssheet {
+	struct cssheet *next;
+	char *text;		// the source, beginning with @ebdelim0url
+	int length;
 	struct desc *descriptors;
+	char *packed;		// the rules, line oriented, for makeSheets
+	int loadcount;
+	int errorBuckets[CSS_ERROR_LAST];
+	int refs;		// frames using this sheet
+	bool cached;		// in the sheet cache
+};
+
+struct cssmaster {
+	struct cssheet **sheets;
+	int nsheets;
 	struct shortcache *cache;
+	struct tagindex *tagindex;
+	int tagindex_n, tagindex_a;
+	int tagindex_tags;	// tags in the window that have been indexed
 };
 
 static void cssPiecesFree(struct desc *d);
@@ -364,18 +392,23 @@ static void cssPiecesPrint(const struct desc *d);
 static void cssAtomic(struct asel *a);
 static void cssParseLeft(struct desc *d);
 static void cssModify(struct asel *a, const char *m1, const char *m2);
+static void readShortCache(struct cssmaster *cm);
 static void chainFree(struct asel *asel);
-static bool onematch, topmatch, skiproot, gcsmatch, bulkmatch, bulktotal;
+static bool onematch, topmatch, skiproot, gcsmatch, bulkmatch;
+static int bulktotal;
 static char matchtype;		// 0 plain 1 before 2 after
 static bool matchhover;		// match on :hover selectors.
 static Tag *rootnode;
 static Tag **doclist;
 static int doclist_a, doclist_n;
+static Tag *doclist_top;	// build doclist from here when it is needed
+static Tag **taglist;	// candidates from the tag index
 static void build_doclist(Tag *top);
 static void hashBuild(void);
 static void hashFree(void);
 static void hashPrint(void);
 static Tag **bestListAtomic(struct asel *a);
+static Tag **tagIndexList(const char *tag);
 static void cssEverybody(void);
 
 static char *fromShortCache(const char *url)
@@ -390,14 +423,23 @@ static char *fromShortCache(const char *url)
 	return 0;
 }
 
-static void intoShortCache(const char *url, char *data)
+// The css master for the current frame, created on first use.
+// Whoever gets there first, cssDocLoad or a querySelectorAll at run time,
+// the short cache has to be loaded along with it.
+static struct cssmaster *cssMasterGet(void)
 {
-	struct shortcache *c;
 	struct cssmaster *cm = cf->cssmaster;
 	if (!cm) {
-// don't know how this could ever happen.
 		cf->cssmaster = cm = allocZeroMem(sizeof(struct cssmaster));
+		readShortCache(cm);
 	}
+	return cm;
+}
+
+static void intoShortCache(const char *url, char *data)
+{
+	struct shortcache *c;
+	struct cssmaster *cm = cssMasterGet();
 	c = allocMem(sizeof(struct shortcache));
 	c->next = cm->cache;
 	cm->cache = c;
@@ -1657,30 +1699,180 @@ static void frameFromWindow(int gsn)
 	}
 }
 
-// The selection string (start) must be allocated - css will use it in place,
-// separating it into all its descriptors.
-// cssFree() will free it.
+/*********************************************************************
+cssGather strings all the style sheets of the page together,
+each one led by @ebdelim0 and its url.
+Sites use the same style sheets on every page, some of them hundreds of K,
+and parsing them again and again is a waste.
+So split the string at these markers, and look each sheet up in a cache
+that is shared by all frames in all windows.
+The key is the url together with the text of the sheet.
+The http cache decides, by etag or last modified, whether the text
+is still good, and if the text is the same, so is the parse.
+A hit hands back the descriptors, which are read only from here on,
+along with the rules in line form for makeSheets,
+and the statistics for cssStats.
+A sheet with @import is parsed every time, since the imported sheets
+are not part of the key, and so is everything when debugging css,
+so the debug file shows the parse.
+Sheets no frame is using are dropped after the cache fills up.
+*********************************************************************/
+
+static struct cssheet *sheetcache;
+static int sheetcache_n;
+#define SHEETCACHEMAX 40
+
+static void sheetFree(struct cssheet *sh)
+{
+	cssPiecesFree(sh->descriptors);
+	nzFree(sh->text);
+	nzFree(sh->packed);
+	free(sh);
+}
+
+// let go of the sheets in this frame
+static void sheetsRelease(struct cssmaster *cm)
+{
+	struct cssheet *sh;
+	int i;
+	for (i = 0; i < cm->nsheets; ++i) {
+		sh = cm->sheets[i];
+		if (--sh->refs == 0 && !sh->cached)
+			sheetFree(sh);
+	}
+	nzFree(cm->sheets);
+	cm->sheets = 0;
+	cm->nsheets = 0;
+}
+
+static struct cssheet *sheetFind(const char *text, int length)
+{
+	struct cssheet *sh, *sh2 = 0;
+	for (sh = sheetcache; sh; sh2 = sh, sh = sh->next) {
+		if (sh->length != length || memcmp(sh->text, text, length))
+			continue;
+		if (sh2) {
+// move to the front
+			sh2->next = sh->next;
+			sh->next = sheetcache;
+			sheetcache = sh;
+		}
+		return sh;
+	}
+	return 0;
+}
+
+static void sheetCache(struct cssheet *sh)
+{
+	struct cssheet *v, *v2, *last, *last2;
+	sh->cached = true;
+	sh->next = sheetcache;
+	sheetcache = sh;
+	++sheetcache_n;
+// drop the least recently used sheets that are not in use
+	while (sheetcache_n > SHEETCACHEMAX) {
+		last = last2 = 0;
+		for (v2 = 0, v = sheetcache; v; v2 = v, v = v->next)
+			if (!v->refs && v != sh)
+				last = v, last2 = v2;
+		if (!last)
+			break;
+		if (last2)
+			last2->next = last->next;
+		else
+			sheetcache = last->next;
+		--sheetcache_n;
+		sheetFree(last);
+	}
+}
+
+static struct cssheet *sheetParse(const char *text, int length)
+{
+	struct cssheet *sh = allocZeroMem(sizeof(struct cssheet));
+	char *save_ls = loadstring;
+	int save_ll = loadstring_l;
+	sh->text = pullString(text, length);
+	sh->length = length;
+	loadstring = initString(&loadstring_l);
+// cssPieces works on the string in place, and keeps it.
+	sh->descriptors = cssPieces(pullString(text, length));
+	sh->packed = loadstring;
+	loadstring = save_ls, loadstring_l = save_ll;
+	sh->loadcount = loadcount;
+	memcpy(sh->errorBuckets, errorBuckets, sizeof(errorBuckets));
+	return sh;
+}
+
+static void cssSheets(struct cssmaster *cm, char *start)
+{
+	struct cssheet *sh;
+	char *s, *u;
+	int i, a = 0, total = 0, buckets[CSS_ERROR_LAST];
+	int hits = 0;
+
+	memset(buckets, 0, sizeof(buckets));
+	for (s = start; *s; s = u) {
+		u = strstr(s + 1, "@ebdelim0");
+		if (!u)
+			u = s + strlen(s);
+		sh = (debugCSS ? 0 : sheetFind(s, u - s));
+		if (sh) {
+			++hits;
+		} else {
+			sh = sheetParse(s, u - s);
+			if (!debugCSS && !strstr(sh->text, "@import"))
+				sheetCache(sh);
+		}
+		++sh->refs;
+		if (cm->nsheets == a) {
+			a = (a ? a * 2 : 8);
+			cm->sheets = (cm->sheets ?
+				      reallocMem(cm->sheets, a * sizeof(struct cssheet *)) :
+				      allocMem(a * sizeof(struct cssheet *)));
+		}
+		cm->sheets[cm->nsheets++] = sh;
+		if (loadstring)
+			stringAndString(&loadstring, &loadstring_l, sh->packed);
+		total += sh->loadcount;
+		for (i = 0; i < CSS_ERROR_LAST; ++i)
+			buckets[i] += sh->errorBuckets[i];
+	}
+	nzFree(start);
+	loadcount = total;
+	memcpy(errorBuckets, buckets, sizeof(buckets));
+	debugPrint(4, "%d style sheets, %d from the sheet cache", cm->nsheets,
+		   hits);
+}
+
+// Does this frame have any css to apply?
+static bool cssAny(const struct cssmaster *cm)
+{
+	int i;
+	for (i = 0; i < cm->nsheets; ++i)
+		if (cm->sheets[i]->descriptors)
+			return true;
+	return false;
+}
+
+// The selection string (start) must be allocated.
+// It is split into style sheets, and freed, see cssSheets().
 void cssDocLoad(int frameNumber, char *start, bool pageload)
 {
 	Frame *save_cf = cf;
 	struct cssmaster *cm;
 	bool recompile = false;
 	frameFromWindow(frameNumber);
-	cm = cf->cssmaster;
-	if (!cm) {
-		cf->cssmaster = cm = allocZeroMem(sizeof(struct cssmaster));
-		readShortCache(cm);
-	}
+	cm = cssMasterGet();
 // This could be run again and again, if the style nodes change.
-	if (cm->descriptors) {
+	if (cm->sheets) {
 		debugPrint(3,
 			   "free and recompile css descriptors due to dom changes");
-		cssPiecesFree(cm->descriptors);
+		sheetsRelease(cm);
 		recompile = true;
 	}
 	if(pageload)
 		loadstring = initString(&loadstring_l);
-	cm->descriptors = cssPieces(start);
+	cssSheets(cm, start);
 	if(pageload) {
 		run_function_onestring_win(cf, "makeSheets", loadstring);
 		nzFree(loadstring);
@@ -1688,7 +1880,7 @@ void cssDocLoad(int frameNumber, char *start, bool pageload)
 	}
 	if (recompile)
 		debugPrint(3, "css complete");
-	if (!cm->descriptors)
+	if (!cssAny(cm))
 		goto done;
 	if (debugCSS) {
 		FILE *f = fopen(cssDebugFile, "a");
@@ -1707,7 +1899,6 @@ void cssDocLoad(int frameNumber, char *start, bool pageload)
 	hashBuild();
 	hashPrint();
 	cssEverybody();
-	debugPrint(3, "%d css assignments", bulktotal);
 	hashFree();
 	nzFree(doclist);
 
@@ -1773,8 +1964,8 @@ void cssFree(Frame *f)
 	struct cssmaster *cm = f->cssmaster;
 	if (!cm)
 		return;
-	if (cm->descriptors)
-		cssPiecesFree(cm->descriptors);
+	sheetsRelease(cm);
+	cssTagIndexFree(f);
 	while ((c = cm->cache)) {
 		cm->cache = c->next;
 		nzFree(c->url);
@@ -1906,100 +2097,90 @@ up:
 }
 
 /*********************************************************************
-A helpful spread routine to find the siblings of where you are.
-Returns 0 if you are at the top and siblings are not meaningful.
-Otherwise allocate an array, which you must free.
-Return is the length of the array.
+Where is a node among its siblings, for :nth-child and friends?
+Spreading out the siblings for every node that is tested makes
+li:nth-child(odd) quadratic over a long list.
+Instead, the first time a node is tested in a match pass,
+number all the children of its parent, elements only,
+among all elements and among elements of the same type,
+and save that in each child.
+The rest of the children then come for free.
+The elements hold still while a selector is matched; css may inject
+text nodes for before and after, but those don't count.
+Every query, and every stylesheet application, starts a new pass.
 *********************************************************************/
 
-struct sibnode {
-	char tag[MAXTAGNAME];
-	int nodeType;
-	int myself;
-	Tag *t;
-};
-static struct sibnode *sibs;
+static unsigned sibPass;
 
-static int spread(Tag *t)
+static int sibNodeType(const Tag *u)
 {
-	int ns = 0;		// number of siblings
-	int i, ntype, me_index = -1;
-			Tag *tp, *u;
-
-	sibs = NULL;
-
-			if (!(tp = t->parent) || tp->action == TAGACT_DOC)
-				return 0;
-			for ((u = tp->firstchild); u; u = u->sibling) {
-				if (u == t)
-					me_index = ns;
-				++ns;
-			}
-			if (me_index < 0)	// should never happen
-				return 0;
-			sibs = allocMem(sizeof(struct sibnode) * ns);
-			for (i = 0, (u = tp->firstchild); i < ns; ++i, u = u->sibling) {
-				strcpy(sibs[i].tag, u->info->name);
-				ntype = 1;
-				if (u->action == TAGACT_TEXT)
-					ntype = 3;
-				if (u->action == TAGACT_DOC)
-					ntype = 9;
-				if (u->action == TAGACT_COMMENT)
-					ntype = 8;
-				sibs[i].nodeType = ntype;
-				sibs[i].myself = (i == me_index);
-			}
-			return ns;
+	if (u->action == TAGACT_TEXT)
+		return 3;
+	if (u->action == TAGACT_DOC)
+		return 9;
+	if (u->action == TAGACT_COMMENT)
+		return 8;
+	return 1;
 }
 
-// when we only need elements, do nothing if ns == 0
-static int spreadElem(int ns)
+static void sibNumber(Tag *tp)
 {
-	int i, j;
-	if (!ns)
-		return 0;
-	for (i = j = 0; i < ns; ++i) {
-		if (sibs[i].nodeType != 1)
+	Tag *u, *v;
+	int n = 0, k;
+	for (u = tp->firstchild; u; u = u->sibling) {
+		u->sibPass = sibPass;
+		u->sibIndex = u->typeIndex = -1;
+		u->sibCount = u->typeCount = 0;
+		if (sibNodeType(u) == 1)
+			u->sibIndex = n++;
+	}
+	for (u = tp->firstchild; u; u = u->sibling) {
+		if (u->sibIndex < 0)
 			continue;
-		if (i > j)
-			sibs[j] = sibs[i];
-		++j;
+		u->sibCount = n;
+// the first of its type numbers them all
+		if (u->typeIndex >= 0)
+			continue;
+		for (k = 0, v = u; v; v = v->sibling)
+			if (v->sibIndex >= 0 && v->info == u->info)
+				v->typeIndex = k++;
+		for (v = u; v; v = v->sibling)
+			if (v->sibIndex >= 0 && v->info == u->info)
+				v->typeCount = k;
 	}
-	if (!j)
-		free(sibs);
-	return j;
 }
 
-// Restrict the list further to elements of the same type
-static int spreadType(int ns)
+// Position of t among its element siblings, or those of its own type.
+// Returns false if t is not an element, or siblings are not meaningful.
+static bool sibPosition(Tag *t, bool oftype, int *index, int *count)
 {
-	int i, j;
-	char mytype[MAXTAGNAME];
-	if (!ns)
-		return 0;
-// find myself
-	for (i = 0; i < ns; ++i)
-		if (sibs[i].myself)
-			break;
-	if (i == ns) {
-		free(sibs);
-		return 0;
-	}
-	strcpy(mytype, sibs[i].tag);
-	for (i = j = 0; i < ns; ++i) {
-		if (!stringEqual(sibs[i].tag, mytype))
-			continue;
-		if (i > j)
-			sibs[j] = sibs[i];
-		++j;
-	}
-	if (!j)
-		free(sibs);
-	return j;
+	Tag *tp = t->parent;
+	if (!tp || tp->action == TAGACT_DOC)
+		return false;
+	if (t->sibPass != sibPass)
+		sibNumber(tp);
+	if (t->sibIndex < 0)
+		return false;
+	*index = (oftype ? t->typeIndex : t->sibIndex);
+	*count = (oftype ? t->typeCount : t->sibCount);
+	return true;
 }
 
-// Like spread but for children, not siblings. Still I use the sibs array.
+/*********************************************************************
+A helpful spread routine to find the children of where you are.
+Returns 0 if there are no children.
+Otherwise allocate an array, which you must free.
+Return is the length of the array.
+*********************************************************************/
+
+struct sibnode {
+	char tag[MAXTAGNAME];
+	int nodeType;
+	int myself;
+	Tag *t;
+};
+static struct sibnode *sibs;
+
 static int spreadKids(Tag *t)
 {
 	int ns = 0;		// number of children
@@ -2316,32 +2497,20 @@ nth_good:
 			if (n_present && coef == 0)
 				n_present = false;
 
-			ns = spread(t);
-			ns = spreadElem(ns);
-			if (oftype)
-				ns = spreadType(ns);
-			if (!ns)
+			if (!sibPosition(t, oftype, &i, &ns))
 				return false;
-// find myself
-			for (i = 0; i < ns; ++i)
-				if (sibs[i].myself)
-					break;
-			rc = false;
-			if (i < ns) {
-				if (last)
-					i = (ns - 1) - i;
-				++i;	// numbers start at 1
-				if (n_present) {
-					i -= constant;
-					if (i % coef)
-						rc = false;
-					else
-						rc = (i / coef) >= 0;
-				} else {
-					rc = (i == constant);
-				}
+			if (last)
+				i = (ns - 1) - i;
+			++i;	// numbers start at 1
+			if (n_present) {
+				i -= constant;
+				if (i % coef)
+					rc = false;
+				else
+					rc = (i / coef) >= 0;
+			} else {
+				rc = (i == constant);
 			}
-			free(sibs);
 			return rc;
 
 nth_bad:
@@ -2357,19 +2526,14 @@ nth_bad:
 		    stringEqual(p, ":first-of-type") ||
 		    stringEqual(p, ":last-of-type") ||
 		    stringEqual(p, ":only-of-type")) {
-			ns = spread(t);
-			ns = spreadElem(ns);
-			if (strstr(p, "of-type"))
-				ns = spreadType(ns);
-			if (!ns)
+			if (!sibPosition(t, ! !strstr(p, "of-type"), &i, &ns))
 				return false;
 			if (p[1] == 'f')
-				rc = sibs[0].myself;
+				rc = (i == 0);
 			if (p[1] == 'l')
-				rc = sibs[ns - 1].myself;
+				rc = (i == ns - 1);
 			if (p[1] == 'o')
-				rc = (ns == 1 && sibs[0].myself);
-			free(sibs);
+				rc = (ns == 1);
 			if (rc)
 				goto next_mod;
 			return false;
@@ -2639,11 +2803,10 @@ static Tag **qsa1(const struct sel *sel)
 		return a;
 	}
 	n = 0;
+	for (i = 0; (t = list[i]); ++i) {
 // querySelectorAll does not match the root, only everything below.
-	i = 0;
-	if (skiproot && list[i])
-		++i;
-	for (; (t = list[i]); ++i) {
+		if (skiproot && t == rootnode)
+			continue;
 		if (qsaMatchChain(t, sel->chain)) {
 			a[n++] = t;
 			if (sel->spec > t->highspec)
@@ -2795,14 +2958,50 @@ static int doclist_cmp(const void *v1, const void *v2)
 	return d;
 }
 
-static Tag **qsaInternal(const char *selstring, Tag *top)
+/*********************************************************************
+Compiled selectors for querySelector and querySelectorAll.
+A page, or its framework, asks for the same handful of selectors
+over and over, so keep the last few compiled descriptors,
+keyed by the selector string, most recently used at the front.
+Matching doesn't change a descriptor, and a selector means the same thing
+in every frame, so one cache serves the whole process.
+A selector that doesn't compile is not cached; it is rare,
+and it has to be parsed again to report the error.
+*********************************************************************/
+
+struct selcache {
+	struct selcache *next;
+	char *selstring;
+	struct desc *d0;
+};
+
+static struct selcache *selcache;
+static int selcache_n, selcache_hits, selcache_misses;
+#define SELCACHEMAX 64
+
+static struct desc *selectorCompile(const char *selstring)
 {
+	struct selcache *c, *c2 = 0;
 	struct desc *d0;
-	Tag **a;
 	char *s;
+
+	for (c = selcache; c; c2 = c, c = c->next) {
+		if (!stringEqual(c->selstring, selstring))
+			continue;
+		++selcache_hits;
+		if (c2) {
+// move to the front
+			c2->next = c->next;
+			c->next = selcache;
+			selcache = c;
+		}
+		return c->d0;
+	}
+
+	++selcache_misses;
+	debugPrint(4, "selector %s, cache %d hits %d misses", selstring,
+		   selcache_hits, selcache_misses);
 // Compile the selector. The string has to be allocated.
-	if (!selstring)
-		selstring = emptyString;
 	s = allocMem(strlen(selstring) + 20);
 	sprintf(s, "%s{c:g}", selstring);
 	d0 = cssPieces(s);
@@ -2824,14 +3023,45 @@ static Tag **qsaInternal(const char *selstring, Tag *top)
 		cssPiecesFree(d0);
 		return 0;
 	}
-	build_doclist(top);
+
+	if (selcache_n == SELCACHEMAX) {
+// drop the least recently used, at the end of the list
+		for (c2 = 0, c = selcache; c->next; c2 = c, c = c->next) ;
+		c2->next = 0;
+		free(c->selstring);
+		cssPiecesFree(c->d0);
+		free(c);
+		--selcache_n;
+	}
+	c = allocMem(sizeof(struct selcache));
+	c->selstring = cloneString(selstring);
+	c->d0 = d0;
+	c->next = selcache;
+	selcache = c;
+	++selcache_n;
+	return d0;
+}
+
+static Tag **qsaInternal(const char *selstring, Tag *top)
+{
+	struct desc *d0;
+	Tag **a;
+	if (!selstring)
+		selstring = emptyString;
+	d0 = selectorCompile(selstring);
+	if (!d0)
+		return 0;
+// doclist is built on demand, see bestListAtomic()
+	doclist_top = top;
+	++sibPass;
 	skiproot = ! !top;
 	if (topmatch)
 		skiproot = false;
 	a = qsa2(d0);
 	nzFree(doclist);
 	doclist = 0;
-	cssPiecesFree(d0);
+	nzFree(taglist);
+	taglist = 0;
 	return a;
 }
 
@@ -3100,6 +3330,7 @@ void cssApply(int frameNumber, Tag *t, int pe)
 	Frame *save_cf = cf;
 	struct cssmaster *cm;
 	struct desc *d;
+	int i;
 
 	frameFromWindow(frameNumber);
 
@@ -3111,16 +3342,18 @@ void cssApply(int frameNumber, Tag *t, int pe)
 
 // it's a getComputedStyle match
 	gcsmatch = true, matchtype = pe;
+	++sibPass;
 // defer to the js
 	nzFree(t->jclass);
 	t->jclass = get_property_string_t(t, "class");
 	nzFree(t->id);
 	t->id = get_property_string_t(t, "id");
 
-	for (d = cm->descriptors; d; d = d->next) {
-		if (qsaMatchGroup(t, d))
-			do_rules(0, d->rules, d->highspec);
-	}
+	for (i = 0; i < cm->nsheets; ++i)
+		for (d = cm->sheets[i]->descriptors; d; d = d->next) {
+			if (qsaMatchGroup(t, d))
+				do_rules(0, d->rules, d->highspec);
+		}
 
 done:
 	cf = save_cf;
@@ -3399,6 +3632,153 @@ static struct hashhead *findKey(struct hashhead *list, int n, const char *key)
 	return 0;		// not found
 }
 
+/*********************************************************************
+The hashes above are built for cssEverybody, when the page loads and no js
+has run, and they are freed right after.
+For querySelectorAll at run time, keep an index of nodes by tag name,
+in each frame, for as long as the frame lives.
+A node never changes its tag, so the index only has to take in
+the nodes that have been created since the last query;
+they are at the end of the tag list, and in order by seqno.
+Every node in the window is indexed, whatever frame created it,
+and a node makes the candidate list only if it reaches the top of the query,
+or the root of this frame, through its parents.
+That leaves out nodes in other frames, and nodes removed from the tree.
+tag_gc renumbers and frees tags, so it throws the index away,
+and the next query builds it again.
+There is no such index for id or class.
+js sets those as ordinary properties, and native code never hears about it,
+so an index could leave out a node that matches.
+*********************************************************************/
+
+static struct tagindex *tagIndexFind(struct cssmaster *cm, const char *key,
+				     bool add)
+{
+	struct tagindex *x;
+	int rc, i, l = -1, r = cm->tagindex_n;
+	while (r - l > 1) {
+		i = (l + r) / 2;
+		x = cm->tagindex + i;
+		rc = strcmp(x->key, key);
+		if (!rc)
+			return x;
+		if (rc > 0)
+			r = i;
+		else
+			l = i;
+	}
+	if (!add)
+		return 0;
+// insert the new key at r
+	if (cm->tagindex_n == cm->tagindex_a) {
+		cm->tagindex_a = (cm->tagindex_a ? cm->tagindex_a * 2 : 64);
+		cm->tagindex = (cm->tagindex ?
+				reallocMem(cm->tagindex,
+					   cm->tagindex_a * sizeof(struct tagindex)) :
+				allocMem(cm->tagindex_a * sizeof(struct tagindex)));
+	}
+	x = cm->tagindex + r;
+	memmove(x + 1, x, (cm->tagindex_n - r) * sizeof(struct tagindex));
+	++cm->tagindex_n;
+	x->key = cloneString(key);
+	x->n = 0, x->a = 8;
+	x->body = allocMem((x->a + 1) * sizeof(Tag *));
+	x->body[0] = 0;
+	return x;
+}
+
+static void tagIndexUpdate(struct cssmaster *cm)
+{
+	struct tagindex *x;
+	Tag *t;
+	char *key, *u;
+	int i;
+	for (i = cm->tagindex_tags; i < cw->numTags; ++i) {
+		t = tagList[i];
+		if (!(t->nodeName && t->nodeName[0]))
+			continue;
+		key = cloneString(t->nodeName);
+		for (u = key; *u; ++u)
+			if (isupper(*u))
+				*u = tolower(*u);
+		x = tagIndexFind(cm, key, true);
+		nzFree(key);
+		if (x->n == x->a) {
+			x->a *= 2;
+			x->body = reallocMem(x->body, (x->a + 1) * sizeof(Tag *));
+		}
+		x->body[x->n++] = t;
+		x->body[x->n] = 0;
+	}
+	cm->tagindex_tags = cw->numTags;
+}
+
+void cssTagIndexFree(Frame *f)
+{
+	struct cssmaster *cm = f->cssmaster;
+	int i;
+	if (!cm)
+		return;
+	for (i = 0; i < cm->tagindex_n; ++i) {
+		free(cm->tagindex[i].key);
+		free(cm->tagindex[i].body);
+	}
+	nzFree(cm->tagindex);
+	cm->tagindex = 0;
+	cm->tagindex_n = cm->tagindex_a = cm->tagindex_tags = 0;
+}
+
+// Is this node in the tree that build_doclist would walk?
+static bool inDoclist(const Tag *t, const Tag *top)
+{
+	const Tag *u;
+	int count = 0;
+	if (t->dead)
+		return false;
+	for (u = t; u; u = u->parent) {
+		if (u == top)
+			return true;
+		if (!top) {
+			if (cf->htmltag) {
+				if (u == cf->htmltag)
+					return true;
+			} else if (u == cf->headtag || u == cf->bodytag)
+				return true;
+		}
+// can't descend into another frame
+		if (u != t && u->action == TAGACT_FRAME)
+			return false;
+		if (++count == 10000)	// tree shouldn't be this deep
+			return false;
+	}
+	return false;
+}
+
+// The nodes with this tag, under the top of the query, in seqno order.
+// Returns 0 if the index can't be used.
+static Tag **tagIndexList(const char *tag)
+{
+	struct cssmaster *cm;
+	struct tagindex *x;
+	Tag *t;
+	int i, n;
+	if (topmatch)
+		return 0;
+	cm = cssMasterGet();
+	tagIndexUpdate(cm);
+	nzFree(taglist);
+	x = tagIndexFind(cm, tag, false);
+	n = (x ? x->n : 0);
+	taglist = allocMem((n + 1) * sizeof(Tag *));
+	for (i = n = 0; x && i < x->n; ++i) {
+		t = x->body[i];
+		if (inDoclist(t, doclist_top))
+			taglist[n++] = t;
+	}
+	taglist[n] = 0;
+	return taglist;
+}
+
 // Return the best list to scan for a given atomic selector.
 // This could be no list at all, if the selector includes .foo,
 // and there is no node of class foo.
@@ -3407,10 +3787,16 @@ static Tag **bestListAtomic(struct asel *a)
 {
 	struct mod *mod;
 	struct hashhead *h, *best_h;
+	Tag **h2;
 	int n, best_n = 0;
 
-	if (!bulkmatch)
+	if (!bulkmatch) {
+		if (a->tag && (h2 = tagIndexList(a->tag)))
+			return h2;
+		if (!doclist)
+			build_doclist(doclist_top);
 		return doclist;
+	}
 
 	if (a->tag) {
 		h = findKey(hashtags, hashtags_n, a->tag);
@@ -3443,27 +3829,71 @@ static Tag **bestListAtomic(struct asel *a)
 	return (best_n ? best_h->body : doclist);
 }
 
-// Cross all selectors and all nodes at document load time.
-// Assumes the hash tables have been built.
+/*********************************************************************
+Cross all selectors and all nodes at document load time.
+Assumes the hash tables have been built.
+The rules go on in six rounds: plain, before, after,
+then the same three again for hover.
+Each selector belongs to just one of these, so sort the descriptors
+into the rounds up front, rather than walking every descriptor six times,
+and skipping the selectors that don't belong.
+A descriptor with selectors in more than one round lands in each of them,
+and qsa2 still picks out the selectors for the round at hand.
+Within a round the descriptors stay in document order,
+and the rounds run in the same order as before, so the cascade is unchanged.
+*********************************************************************/
+
 static void cssEverybody(void)
 {
 	struct cssmaster *cm = cf->cssmaster;
-	struct desc *d0 = cm->descriptors, *d;
+	struct desc *d;
+	struct desc **rounds[6];
+	int rounds_n[6];
+	struct sel *sel;
 	Tag **a, **u;
 	Tag *t;
-	int l;
+	int i, l, j, n;
+	uchar mask;
+	struct timeval tv0, tv1;
 
+	gettimeofday(&tv0, NULL);
 	bulkmatch = true;
+	++sibPass;
 	bulktotal = 0;
 	skiproot = false;
 	rootnode = 0;
 
+	for (n = i = 0; i < cm->nsheets; ++i)
+		for (d = cm->sheets[i]->descriptors; d; d = d->next)
+			++n;
 	for (l = 0; l < 6; ++l) {
-		matchhover = (l >= 3);
-		matchtype = l % 3;
-		for (d = d0; d; d = d->next) {
+		rounds[l] = allocMem((n + 1) * sizeof(struct desc *));
+		rounds_n[l] = 0;
+	}
+	for (i = 0; i < cm->nsheets; ++i)
+		for (d = cm->sheets[i]->descriptors; d; d = d->next) {
 			if (d->error)
 				continue;
+			mask = 0;
+			for (sel = d->selectors; sel; sel = sel->next) {
+// before and after together can't match anything
+				if (sel->error || (sel->before & sel->after))
+					continue;
+				l = (sel->before ? 1 : (sel->after ? 2 : 0));
+				if (sel->hover)
+					l += 3;
+				mask |= (1 << l);
+			}
+			for (l = 0; l < 6; ++l)
+				if (mask & (1 << l))
+					rounds[l][rounds_n[l]++] = d;
+		}
+
+	for (l = 0; l < 6; ++l) {
+		matchhover = (l >= 3);
+		matchtype = l % 3;
+		for (j = 0; j < rounds_n[l]; ++j) {
+			d = rounds[l][j];
 			a = qsa2(d);
 			if (!a)
 				continue;
@@ -3474,8 +3904,13 @@ static void cssEverybody(void)
 			}
 			nzFree(a);
 		}
+		free(rounds[l]);
 	}
 	bulkmatch = false;
 	matchtype = 0;
 	matchhover = false;
+	gettimeofday(&tv1, NULL);
+	debugPrint(3, "%d css assignments in %ld usec", bulktotal,
+		   (long)(tv1.tv_sec - tv0.tv_sec) * 1000000 + (tv1.tv_usec -
+								tv0.tv_usec));
 }
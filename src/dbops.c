@@ -1323,7 +1323,7 @@ void sql_unfold(int start, int end, char action)
 			((start <= ln && end >= ln) ||
 			(start <= ln + nc && end >= ln + nc) ||
 			(start > ln && end < ln + nc))) {
-				free((char*)s);
+				freeLineText((pst)s);
 // how many pipes do we need to escape?
 				len2 = 0;
 				for(j = 1; j <= nc; ++j) {
@@ -1343,7 +1343,7 @@ void sql_unfold(int start, int end, char action)
 						*w++ = *s;
 					}
 					*w++ = '|';
-					free((char*)s0);
+					freeLineText((pst)s0);
 				}
 				w[-1] = '\n';
 				cw->dot = ln2;
@@ -1351,7 +1351,7 @@ void sql_unfold(int start, int end, char action)
 			} else {
 // no change, just copy
 				for(j = 0; j <= nc; ++j)
-					newmap[ln2 + j].text = cw->map[ln + j].text;
+					newmap[ln2 + j].text = lineAt(cw->map, ln + j)->text;
 				ln2 += nc + 1;
 			}
 			ln += nc;
@@ -1378,15 +1378,16 @@ void sql_unfold(int start, int end, char action)
 				newmap[ln2 + j].text = (pst)v;
 			}
 			ln2 += nc;
-			free((char*)s);
+			freeLineText((pst)s);
 		} else {
 // no change, just copy
-			newmap[ln2++].text = cw->map[ln].text;
+			newmap[ln2++].text = lineAt(cw->map, ln)->text;
 		}
 	}
 
-	free(cw->map);
-	cw->map = newmap;
+	freeLineIndex(cw->map);
+	cw->map = newLineIndex(newmap + 1, newdol);
+	free(newmap);
 	cw->dol = newdol;
 }
 
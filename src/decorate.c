@@ -1131,6 +1131,27 @@ static void link_css(Tag *t)
 			else
 				nzFree(b);
 		}
+	} else if (down_jsbg) {
+		debugPrint(3, "css source %s", t->href);
+// through the scheduler, ahead of any async scripts;
+// it has probably been prefetched, see prefetchCSS()
+		if (!t->fetchstate)
+			fetchSubmit(t, httpConnectBack4, FETCH_BLOCKING);
+		if (!fetchDone(t, true)) {
+// interrupted, the fetch is still running and owns t->value
+			if (debugLevel >= 3)
+				i_printf(MSG_GetCSS2);
+		} else {
+			if (!t->loadsuccess) {
+				if (debugLevel >= 3)
+					i_printf(MSG_GetCSS2);
+			} else if (t->hcode != 200) {
+				if (debugLevel >= 3)
+					i_printf(MSG_GetCSS, t->href, t->hcode);
+			}
+			a = t->value;
+			t->value = 0;
+		}
 	} else {
 		debugPrint(3, "css source %s", t->href);
 		memset(&g, 0, sizeof(g));
@@ -1220,10 +1241,10 @@ Needless to say that's not good!
 			const char *w = t->textval;
 			if (!w)
 				w = emptyString;
-			set_property_string_t(t, "data", w);
+			set_hotprop_string_t(t, HP_DATA, w);
 			w = (t->jclass ? t->jclass : emptyString);
-			set_property_string_t(t, "class", w);
-			set_property_string_t(t, "last$class", w);
+			set_hotprop_string_t(t, HP_CLASS, w);
+			set_hotprop_string_t(t, HP_LASTCLASS, w);
 		}
 		break;
 
@@ -1246,27 +1267,27 @@ Needless to say that's not good!
 		a = attribVal(t, "type");
 		if (!a)
 			a = emptyString;
-		set_property_string_t(t, "type", a);
+		set_hotprop_string_t(t, HP_TYPE, a);
 		break;
 
 	case TAGACT_SCRIPT:
 		domLink(t, "HTMLScriptElement", "src", "scripts", 0, 4);
 		a = attribVal(t, "type");
 		if (a)
-			set_property_string_t(t, "type", a);
+			set_hotprop_string_t(t, HP_TYPE, a);
 		a = attribVal(t, "text");
 		if (a) {
-			set_property_string_t(t, "text", a);
+			set_hotprop_string_t(t, HP_TEXT, a);
 		} else {
-			set_property_string_t(t, "text", "");
+			set_hotprop_string_t(t, HP_TEXT, "");
 		}
 		a = attribVal(t, "src");
 		if (a) {
-			set_property_string_t(t, "src", a);
+			set_hotprop_string_t(t, HP_SRC, a);
 			if (down_jsbg && a[0])	// from another source, let's get it started
 				prepareScript(t);
 		} else {
-			set_property_string_t(t, "src", "");
+			set_hotprop_string_t(t, HP_SRC, "");
 		}
 		break;
 
@@ -1592,9 +1613,52 @@ static void pushAttributes(const Tag *t)
 	}
 }
 
+/*********************************************************************
+Start fetching all the stylesheets of the tree at once,
+before decorate comes to them one at a time.
+These are the sheets that link_css would pull from the internet,
+on the tags that jsNode will decorate.
+link_css then waits for its sheet, which is probably here by now.
+*********************************************************************/
+
+static void prefetchCSS(int start)
+{
+	int i;
+	Tag *t;
+	const char *a1, *a2, *altsource, *realsource;
+
+	if (!down_jsbg)
+		return;
+
+	for (i = start; i < cw->numTags; ++i) {
+		t = tagList[i];
+		if (t->action != TAGACT_LINK || !t->href || t->dead ||
+		    t->step >= 2 || t->f0 != cf || t->fetchstate)
+			continue;
+		a1 = attribVal(t, "type");
+		a2 = attribVal(t, "rel");
+		if (!stringEqualCI(a1, "text/css") &&
+		    !stringEqualCI(a2, "stylesheet"))
+			continue;
+		altsource = fetchReplace(t->href);
+		realsource = (altsource ? altsource : t->href);
+		if ((browseLocal || altsource) && !isURL(realsource))
+			continue;
+// this has to happen before threads spin off
+		if (!curlActive) {
+			eb_curl_global_init();
+			cookiesFromJar();
+			setupEdbrowseCache();
+		}
+		debugPrint(3, "css prefetch %s", t->href);
+		fetchSubmit(t, httpConnectBack4, FETCH_BLOCKING);
+	}
+}
+
 /* decorate the tree of nodes with js objects */
 void decorate(int start)
 {
+	prefetchCSS(start);
 	traverse_callback = jsNode;
 	traverseAll(start);
 }
@@ -1632,6 +1696,7 @@ void tag_gc(void)
 {
 	int cx;			/* edbrowse context */
 	Window *w, *save_cw;
+	Frame *f;
 	Tag *t;
 	int i, j;
 
@@ -1664,6 +1729,9 @@ void tag_gc(void)
 			debugPrint(4, "tag_gc from %d to %d", w->numTags, j);
 			w->numTags = j;
 			w->deadTags = 0;
+// the css tag index points to the old tags
+			for (f = &w->f0; f; f = f->next)
+				cssTagIndexFree(f);
 
 // We must rerender when we return to this window,
 // or at the input loop if this is the current window.
@@ -1788,6 +1856,8 @@ const struct tagInfo availableTags[] = {
 static void freeTag(Tag *t)
 {
 	char **a;
+	if (t->fetchstate == 1)
+		fetchCancel(t, true);
 // Even if js has been turned off, if this tag was previously connected to an
 // object, we should disconnect it.
 	if(t->jslink)
@@ -1845,6 +1915,11 @@ void freeTags(Window *w)
 		freeEmptySideBuffer(n);
 	}			/* loop over tags */
 
+// stop all the background fetches at once, before waiting on any of them
+	for (i = 0; i < w->numTags; ++i)
+		if (e[i]->fetchstate == 1)
+			fetchCancel(e[i], false);
+
 	for (i = 0; i < w->numTags; ++i, ++e) {
 		t = *e;
 		freeTag(t);
@@ -89,6 +89,11 @@ extern char frameContent[];
 	extern const char startWindowJS[];
 	extern const char deminJS[];
 	extern const char sharedJS[];
+// the same scripts compiled to bytecode, length 0 if not available
+	extern const unsigned char sharedBC[];
+	extern const size_t sharedBC_len;
+	extern const unsigned char startWindowBC[];
+	extern const size_t startWindowBC_len;
 // this is crude but it works.
 #define WithDebugging (strlen(deminJS) > 5000)
 
@@ -107,6 +112,19 @@ enum ej_proptype {
 	EJ_PROP_NULL,
 };
 
+/* Property names that are set on every tag, or on every sync with the buffer.
+ * The js engine interns these once; hotPropNames[] has the strings. */
+enum hotprop {
+	HP_CHECKED, HP_VALUE, HP_VAL_UE, HP_INNERHTML, HP_INNER_HTML,
+	HP_TEXT, HP_DATA, HP_TYPE, HP_SRC,
+	HP_CLASS, HP_LASTCLASS, HP_NAME, HP_ID, HP_LASTID,
+	HP_NODENAME, HP_TAGNAME, HP_NODETYPE, HP_OWNERDOCUMENT,
+	HP_STYLE, HP_FORM, HP_OPTIONS, HP_CHILDNODES, HP_DOMCLASS, HP_LENGTH,
+	HP_SEQNO, HP_GSN,
+	HP_MAX
+};
+extern const char *const hotPropNames[HP_MAX];
+
 /* ctype macros, when you're passing a byte,
  * and you don't want to worry about whether it's char or uchar.
  * Call the regular routines when c is an int, from fgetc etc. */
@@ -191,6 +209,10 @@ extern bool newloc_r; /* location replaces this page */
 extern struct ebFrame *newloc_f; /* frame calling for new web page */
 extern const char *ebrc_string; /* default ebrc file */
 
+// priorities for the fetch scheduler
+#define FETCH_ASYNC 0 // async scripts and xhr
+#define FETCH_BLOCKING 1 // scripts and stylesheets that hold up the page
+
 // Get data from the internet. Zero the structure, set the
 // members you need, then call httpConnect.
 struct i_get {
@@ -224,6 +246,8 @@ struct i_get {
 	bool csp; // content supresses plugins
 	bool is_http;
 	bool cacheable;
+// a background fetch stops when this is set, see fetchCancel()
+	const volatile bool *cancel;
 	bool last_curlin;
 	bool move_capable;
 	char error[CURL_ERROR_SIZE + 1];
@@ -242,6 +266,11 @@ long long hcl;			/* http content length */
 	char auth_realm[60];	/* WWW-Authenticate realm header */
 	char *newloc;
 	int newloc_d;
+// A large body can go to a temp file instead of memory, see spillBody()
+	bool spill_ok;	/* the caller can take the body from a file */
+	int spill_fd;
+	char *spill_file;	/* the body is here, and not in buffer */
+	long long spill_length;
 };
 
 struct MACCOUNT { // email account, pop3 or imap
@@ -391,6 +420,11 @@ struct lineMap {
 };
 #define LMSIZE sizeof(struct lineMap)
 
+/* The lines of a buffer live in chunks, not one flat array;
+ * see the line index routines in buffers.c. */
+struct lineIndex;
+struct textSlab;
+
 /* an edbrowse frame, as when there are many frames in an html page.
  * There could be several frames in an edbrowse window or buffer, chained
  * together in a linked list, but usually there is just one, as when editing
@@ -457,7 +491,13 @@ struct ebWindow {
 	char *saveURL;		// for the fu command
 	char *mailInfo;
 	char lhs[MAXRE], rhs[MAXRE];	/* remembered substitution strings */
-	struct lineMap *map, *r_map;
+	struct lineIndex *map, *r_map;
+	struct textSlab *slab; // open slab for the text of new lines
+// line of each input field in the buffer, see locateTagInBuffer()
+	int *fieldLines, fieldMax;
+	unsigned fieldSerial;
+// new with every change to this buffer, see undoLog()
+	unsigned changeSerial;
 /* The labels that you set with the k command, and access via 'x.
  * Basically, that's 26 line numbers.
  * Number 0 means the label is not set.
@@ -499,6 +539,12 @@ int ehsn;
 	bool sqlMode:1;		// accessing a table
 	struct DBTABLE *table;	/* if in sqlMode */
 	time_t nextrender;
+// the last render, before reformatting, and the buffer it produced;
+// see rerender()
+	char *lastrender;
+	unsigned renderSerial;
+	int renderLength;
+	bool renderOverflow;
 };
 typedef struct ebWindow Window;
 extern Window *cw;	/* current window */
@@ -512,10 +558,9 @@ extern Window *cw;	/* current window */
 #define isJSAlive (cf->jslink && allowJS)
 
 /*********************************************************************
-Temporary cap on the number of lines, so the integer index into cw->map
-doesn't overflow. This is basically signed int over LMSIZE.
-The former is 2^31 on most machines,
-the latter is at most 12 on a 64-bit machine.
+Temporary cap on the number of tags, so the integer index into cw->tags
+doesn't overflow. This use to cap the lines in a buffer as well,
+but those are chunked now, and never live in one giant array.
 If ints are larger then I don't even use this constant.
 *********************************************************************/
 
@@ -573,9 +618,10 @@ struct htmlTag {
 	const char **atvals;
 /* the form that owns this input tag */
 	struct htmlTag *controller;
-	pthread_t loadthread;
 	long hcode;
 	bool loadsuccess;
+	uchar fetchstate; // 0 none, 1 submitted to the fetch scheduler, 2 fetched
+	volatile bool fetchcancel; // the tag is going away, see fetchCancel()
 	uchar step; // prerender, decorate, load script, runscript
 	bool slash:1;		/* as in </A> */
 	bool textin:1; /* <a> some text </a> */
@@ -614,6 +660,7 @@ struct htmlTag {
 	bool iscolor:1;
 	bool ur:1;		// row unfolded, only for trf
 	bool inur:1;		// in ur command
+	bool dirty:1;		// field changed by the user, not yet passed to js
 	char subsup;		/* span turned into sup or sub */
 	uchar itype;		// input type =
 	uchar itype_minor;
@@ -631,6 +678,11 @@ struct htmlTag {
 	char *innerHTML; /* the html string under this tag */
 	int inner;		/* for inner html */
 	int highspec; // specificity of a selector that matches this node
+	unsigned syncSerial; // textarea: side buffer changes already passed to js
+// position among element siblings, and among siblings of the same type,
+// valid for css match pass sibPass; see sibPosition()
+	int sibIndex, sibCount, typeIndex, typeCount;
+	unsigned sibPass;
 };
 
 typedef struct htmlTag Tag;
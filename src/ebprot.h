@@ -13,6 +13,12 @@ extern "C" {
 /* sourcefile=buffers.c */
 void undoSpecialClear(void);
 void removeHiddenNumbers(pst p, uchar terminate);
+struct lineMap *lineAt(struct lineIndex *x, int n);
+struct lineIndex *newLineIndex(const struct lineMap *lines, int nlines);
+void freeLineIndex(struct lineIndex *x);
+void freeLineText(pst p);
+void swapLines(int a, int b);
+void bufferChanged(void);
 pst fetchLine(int n, int show);
 void displayLine(int n);
 void initializeReadline(void);
@@ -176,6 +182,10 @@ bool httpConnect(struct i_get *g);
 void *httpConnectBack1(void *ptr);
 void *httpConnectBack2(void *ptr);
 void *httpConnectBack3(void *ptr);
+void *httpConnectBack4(void *ptr);
+void fetchSubmit(Tag *t, void *(*fn)(void *), int priority);
+bool fetchDone(Tag *t, bool wait);
+void fetchCancel(Tag *t, bool wait);
 void ebcurl_setError(CURLcode curlret, const char *url, int action, const char *curl_error);
 void setHTTPLanguage(const char *lang);
 int prompt_and_read(int prompt, char *buffer, int buffer_length, int error_message, bool hide_echo);
@@ -188,6 +198,7 @@ bool reexpandFrame(void);
 
 /* sourcefile=main.c */
 void ebClose(int n);
+bool foregroundThread(void);
 void setDataSource(char *v);
 bool javaOK(const char *url);
 bool mustVerifyHost(const char *url);
@@ -386,6 +397,7 @@ void writeShortCache(void);
 bool matchMedia(char *t);
 void cssDocLoad(int frameNumber, char *s, bool pageload);
 void cssFree(Frame *f);
+void cssTagIndexFree(Frame *f);
 Tag **querySelectorAll(const char *selstring, Tag *top);
 Tag *querySelector(const char *selstring, Tag *top);
 bool querySelector0(const char *selstring, Tag *top);
@@ -431,8 +443,10 @@ int get_property_number_t(const Tag *t, const char *name);
 char * get_property_string_t(const Tag *t, const char *name);
 char *get_dataset_string_t(const Tag *t, const char *name);
 void set_property_bool_t(const Tag *t, const char *name, bool v);
+void set_hotprop_bool_t(const Tag *t, enum hotprop p, bool v);
 void set_property_number_t(const Tag *t, const char *name, int v);
 void set_property_string_t(const Tag *t, const char *name, const char * v);
+void set_hotprop_string_t(const Tag *t, enum hotprop p, const char * v);
 void set_dataset_string_t(const Tag *t, const char *name, const char * v);
 void set_property_bool_win(const Frame *f, const char *name, bool v);
 void set_property_string_win(const Frame *f, const char *name, const char *v);
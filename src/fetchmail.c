@@ -3211,28 +3211,15 @@ nextline:
 	repln = strchr(linetype, 'r') - linetype;
 	subln = strchr(linetype, 's') - linetype;
 	if (repln != 1) {
-		struct lineMap *map = cw->map;
-		struct lineMap swap;
-		struct lineMap *q1 = map + 1;
-		struct lineMap *q2 = map + repln;
-		swap = *q1;
-		*q1 = *q2;
-		*q2 = swap;
+		swapLines(1, repln);
 		if (subln == 1)
 			subln = repln;
 		repln = 1;
 	}
 
 	j = strlen(linetype) - 1;
-	if (j != subln) {
-		struct lineMap *map = cw->map;
-		struct lineMap swap;
-		struct lineMap *q1 = map + j;
-		struct lineMap *q2 = map + subln;
-		swap = *q1;
-		*q1 = *q2;
-		*q2 = swap;
-	}
+	if (j != subln)
+		swapLines(j, subln);
 
 	readReplyInfo();
 
@@ -252,15 +252,27 @@ fail:
 	return false;
 }
 
+// in the order of enum hotprop in eb.h
+const char *const hotPropNames[HP_MAX] = {
+	"checked", "value", "val$ue", "innerHTML", "inner$HTML",
+	"text", "data", "type", "src",
+	"class", "last$class", "name", "id", "last$id",
+	"nodeName", "tagName", "nodeType", "ownerDocument",
+	"style", "form", "options", "childNodes", "dom$class", "length",
+	"eb$seqno", "eb$gsn",
+};
+
 /*********************************************************************
 Sync up the javascript variables with the input fields.
 This is required before running any javascript, e.g. an onclick function.
 After all, the input fields may have changed.
 You may have changed the last name from Flintstone to Rubble.
 This has to propagate down to the javascript strings in the DOM.
-This is quick and stupid; I just update everything.
-Most of the time I'm setting the strings to what they were before;
-that's the way it goes.
+Only the fields that have changed since the last sync are pushed.
+An input field is marked dirty when the user changes it, see updateFieldInBuffer();
+a textarea is its own buffer, and that buffer is stamped with a new
+changeSerial by every edit, undo and redo included, see bufferChanged(),
+so compare it with the serial we saw the last time through.
 *********************************************************************/
 
 void jSyncup(bool fromtimer, const Tag *active)
@@ -268,6 +280,7 @@ void jSyncup(bool fromtimer, const Tag *active)
 	Tag *t;
 	int itype, j, cx;
 	char *value, *cxbuf;
+	const Window *sw;	// side window for a textarea
 
 	if (!cw->browseMode)
 		return;		/* not necessary */
@@ -288,12 +301,23 @@ void jSyncup(bool fromtimer, const Tag *active)
 		if (itype <= INP_HIDDEN)
 			continue;
 
+// Only the fields that the user has changed since the last sync.
+// A textarea is its own buffer; has it changed?
+		if (itype == INP_TA) {
+			cx = t->lic;
+			if (!cx || !(sw = sessionList[cx].lw) ||
+			    sw->changeSerial == t->syncSerial)
+				continue;
+		} else if (!t->dirty)
+			continue;
+		t->dirty = false;
+
 		if (itype >= INP_RADIO) {
 			int checked = fieldIsChecked(t->seqno);
 			if (checked < 0)
 				continue;
 			t->checked = checked;
-			set_property_bool_t(t, "checked", checked);
+			set_hotprop_bool_t(t, HP_CHECKED, checked);
 			continue;
 		}
 
@@ -317,7 +341,7 @@ void jSyncup(bool fromtimer, const Tag *active)
 
 		if (itype == INP_TA) {
 			if (!value) {
-				set_property_string_t(t, "value", 0);
+				set_hotprop_string_t(t, HP_VALUE, 0);
 				continue;
 			}
 /* Now value is just <buffer 3>, which is meaningless. */
@@ -328,13 +352,14 @@ void jSyncup(bool fromtimer, const Tag *active)
 // unfoldBuffer could fail if we have quit that session.
 			if (!unfoldBuffer(cx, false, &cxbuf, &j))
 				continue;
-			set_property_string_t(t, "value", cxbuf);
+			set_hotprop_string_t(t, HP_VALUE, cxbuf);
 			nzFree(cxbuf);
+			t->syncSerial = sw->changeSerial;
 			continue;
 		}
 
 		if (value) {
-			set_property_string_t(t, "value", value);
+			set_hotprop_string_t(t, HP_VALUE, value);
 			nzFree(t->value);
 			t->value = value;
 		}
@@ -580,14 +605,15 @@ void prepareScript(Tag *t)
 				setupEdbrowseCache();
 			}
 
-			if (down_jsbg && !demin && !uvw
-			    && !pthread_create(&t->loadthread, NULL,
-					       httpConnectBack2, (void *)t)) {
+			if (down_jsbg && !demin && !uvw) {
+				fetchSubmit(t, httpConnectBack2,
+					    (t->async ? FETCH_ASYNC :
+					     FETCH_BLOCKING));
 				t->js_ln = 1;
 				js_file = realsource;
 				filepart = getFileURL(js_file, true);
 				t->js_file = cloneString(filepart);
-// stop here and wait for the child process to download
+// stop here and wait for the scheduler to download
 				t->step = 3;
 				return;
 			}
@@ -761,6 +787,21 @@ bool isRooted(const Tag *t)
 	return false;
 }
 
+// Pass the response of an asynchronous xhr to javascript, in pieces;
+// see httpConnectBack3() and xml_parse in shared.js.
+static void xhrResponse(Tag *t)
+{
+	set_property_bool_t(t, "$success", t->loadsuccess);
+	set_property_number_t(t, "$code", t->hcode);
+	set_property_string_t(t, "$url", t->href);
+	set_property_string_t(t, "$headers", t->custom_h);
+	set_property_string_t(t, "responseText", t->value);
+	nzFree(t->value);
+	t->value = 0;
+	nzFree(t->custom_h);
+	t->custom_h = 0;
+}
+
 void runScriptsPending(bool startbrowse)
 {
 	Tag *t;
@@ -834,18 +875,20 @@ passes:
 
 		if (t->step == 3) {
 // waiting for background process to load
-			pthread_join(t->loadthread, NULL);
-			if (!t->loadsuccess || t->hcode != 200) {
+			if (!fetchDone(t, true) ||
+			    !t->loadsuccess || t->hcode != 200) {
 				if (debugLevel >= 3)
 					i_printf(MSG_GetJS, t->href, t->hcode);
 				t->step = 6;
 				continue;
 			}
-			set_property_string_t(t,
-					    (t->inxhr ? "$entire" : "text"),
-					    t->value);
-			nzFree(t->value);
-			t->value = 0;
+			if (t->inxhr) {
+				xhrResponse(t);
+			} else {
+				set_property_string_t(t, "text", t->value);
+				nzFree(t->value);
+				t->value = 0;
+			}
 			t->step = 4;	// loaded
 		}
 
@@ -1288,8 +1331,12 @@ updateFieldInBuffer(int tagno, const char *newtext, bool notify, bool fromForm)
 		memcpy(new, p, s - p);
 		strcpy(new + (s - p), newtext);
 		memcpy(new + strlen(new), t, plen - (t - p));
-		free(cw->map[ln].text);
-		cw->map[ln].text = (pst) new;
+		freeLineText(lineAt(cw->map, ln)->text);
+		lineAt(cw->map, ln)->text = (pst) new;
+		bufferChanged();
+// a change from the form has to be passed to js, see jSyncup
+		if (fromForm)
+			tagList[tagno]->dirty = true;
 		if (notify && debugLevel> 0)
 			displayLine(ln);
 		return;
@@ -2892,17 +2939,9 @@ void rerender(int rr_command)
 // You might have changed some input fields on the screen, then typed rr
 		jSyncup(true, 0);
 	}
-// screen snap, to compare with the new screen.
-	if (!unfoldBufferW(cw, false, &snap, &j)) {
-		snap = 0;
-		puts("no screen snap available");
-		return;
-	}
 
 /* and the new screen */
 	a = render(0);
-	newbuf = htmlReformat(a);
-	nzFree(a);
 
 	if (rr_command > 0 && debugLevel >= 3) {
 		char buf[120];
@@ -2925,11 +2964,54 @@ void rerender(int rr_command)
 			debugPrint(3, "%s", buf);
 	}
 
+/*********************************************************************
+Every node is rendered, every time. Rendering only the subtrees that
+javascript has touched would need every change to reach native code,
+and most don't: t.style.display = "none", t.className = "x",
+textNode.data = "hello", setAttribute, are handled entirely in js.
+appendChild, removeChild, innerHTML and value do come through here,
+but marking only those would leave stale text on the screen.
+What we can do is skip the rest of the work when nothing has changed.
+The render string, before reformatting, is cheap to compare.
+If it is the same as last time, and the buffer hasn't changed since,
+then reformatting would only give back the buffer we already have,
+so there is no need to snap the buffer, reformat, or diff.
+This is the usual story with a timer that fires and changes nothing.
+The line length and overflow setting are part of the key,
+since they steer htmlReformat; see the fll command.
+*********************************************************************/
+	if (cw->lastrender && stringEqual(a, cw->lastrender) &&
+	    cw->renderSerial == cw->changeSerial &&
+	    cw->renderLength == formatLineLength &&
+	    cw->renderOverflow == formatOverflow) {
+		nzFree(a);
+		if (rr_command > 0)
+			i_puts(MSG_NoChange);
+		return;
+	}
+	nzFree(cw->lastrender);
+// htmlReformat scribbles on its input, so keep a copy.
+	cw->lastrender = cloneString(a);
+	cw->renderLength = formatLineLength;
+	cw->renderOverflow = formatOverflow;
+	cw->renderSerial = 0;
+
+// screen snap, to compare with the new screen.
+	if (!unfoldBufferW(cw, false, &snap, &j)) {
+		nzFree(a);
+		puts("no screen snap available");
+		return;
+	}
+
+	newbuf = htmlReformat(a);
+	nzFree(a);
+
 /* the high runner case, most of the time nothing changes,
  * and we can check that efficiently with strcmp */
 	if (stringEqual(newbuf, snap)) {
 		if (rr_command > 0)
 			i_puts(MSG_NoChange);
+		cw->renderSerial = cw->changeSerial;
 		nzFree(newbuf);
 		nzFree(snap);
 		return;
@@ -2954,6 +3036,8 @@ void rerender(int rr_command)
 	else if (addtop)
 		cw->dot = addtop;
 	cw->undoable = false;
+// the buffer now matches lastrender
+	cw->renderSerial = cw->changeSerial;
 
 /*********************************************************************
 It's almost easier to do it than to report it.
@@ -3437,17 +3521,7 @@ We need to fix this someday, though it is a very rare corner case.
 	if ((t = jt->t)) {
 // asynchronous script or xhr
 		if (t->step == 3) {	// background load
-			int rc =
-			    pthread_tryjoin_np(t->loadthread, NULL);
-			if (rc != 0 && rc != EBUSY) {
-// should never happen
-				debugPrint(3,
-					   "script background thread test returns %d",
-					   rc);
-				pthread_join(t->loadthread, NULL);
-				rc = 0;
-			}
-			if (!rc) {	// it's done
+			if (fetchDone(t, false)) {	// it's done
 				if (!t->loadsuccess ||
 				(t->action == TAGACT_SCRIPT &&  t->hcode != 200)) {
 					if (debugLevel >= 3)
@@ -3485,9 +3559,7 @@ We need to fix this someday, though it is a very rare corner case.
 		}
 		if (t->step == 4 && t->action != TAGACT_SCRIPT) {
 			t->step = 5;
-			set_property_string_t(t, "$entire", t->value);
-			nzFree(t->value);
-			t->value = 0;
+			xhrResponse(t);
 			debugPrint(3, "run xhr %d", jt->tsn);
 			run_function_bool_t(t, "parseResponse");
 		}
@@ -1922,64 +1922,227 @@ void mergeCookies(void)
 /*********************************************************************
 Maintain a cache of the http files.
 The url is the key.
-The result is a string that holds a 5 digit filename, the etag,
+Each record holds a 5 digit filename, the etag,
 last modified time, last access time, and file size.
-nnnnn tab etag tab last-mod tab access tab size
 The access time helps us clean house; delete the oldest files.
 If you change the format of this file in any way, increment the version number.
 Previous cache files will be left hanging around, but oh well.
 Not expecting to change this file format very often.
 cacheDir is the directory holding the cached files,
 and cacheControl is the file that houses the database.
-I open a lock file with O_EXCL when accessing the cache,
-and if busy then I wait a few milliseconds and try again.
+Access is guarded by an advisory fcntl lock on a lock file beside the control
+file, shared for looking things up and exclusive for storing things.
+The kernel drops the lock if the process dies, so there are no stale locks.
+fcntl locks belong to the process, not the thread,
+so a mutex keeps our own threads out of each other's way.
+Windows doesn't have fcntl; there I open the lock file with O_EXCL.
+Either way, if the lock is busy I wait a few milliseconds and try again,
+for at most a second, and then give up, which is just a cache miss.
 If the stored etag and header etag are both present, and don't match,
 then the file is stale.
 If one or the other etag is missing, and mod time website > mod time cached,
 then the file is stale.
 We don't even query the cache if we don't have at least one of etag or mod time.
+
+The control file is binary, and it is a log.
+Each record is a struct CDISK followed by the url and the etag, no nulls.
+Storing a page appends a record, and a later record for the same url
+supersedes the earlier one.
+Touching a page, when it is fetched from cache,
+rewrites its access time in place.
+Nothing else changes the file, except a compaction, which happens when
+we prune the oldest files or when there are too many superseded records.
+Compaction writes a new file and renames it over the old one.
+So the inode and the length of the control file tell us everything;
+if they are the same as last time we have nothing to read,
+if the file is longer we read and parse the new records at the end,
+and if it is a different file we read the whole thing again.
+Other processes touching access times in place don't change the length,
+and we don't care, except when pruning,
+so we reread the whole file just before we prune.
+The records live in memory, in an array hashed on the url.
+The hash only looks at the parts of the url that sameURL() looks at,
+so urls that are the same land in the same bucket.
 *********************************************************************/
 
-#define CACHECONTROLVERSION 1
+#define CACHECONTROLVERSION 2
 
 #ifdef DOSLIKE
 #define USLEEP(a) Sleep(a / 1000)	// sleep millisecs
 #else
 #define USLEEP(a) usleep(a)	// sleep microsecs
+static int lock_fh = -1;	/* file handle for cacheLock */
 #endif
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int control_fh = -1;	/* file handle for cacheControl */
-static char *cache_data;
 static time_t now_t;
 static char *cacheFile, *cacheLock, *cacheControl;
 
 /* a cache entry */
 struct CENTRY {
-	off_t offset;
-	size_t textlength;
-	const char *url;
+	off_t offset;		/* of its record in the control file */
+	char *url;
+	char *etag;
+	unsigned hash;
+	int hnext;		/* next entry in this hash bucket */
 	int filenumber;
-	const char *etag;
 	int modtime;
 	int accesstime;
 	int pages;		/* in 4K pages */
 };
 
+/* a record in the control file, followed by the url and the etag */
+struct CDISK {
+	int filenumber;
+	int modtime;
+	int accesstime;
+	int pages;
+	int urllen;
+	int etaglen;
+};
+
 static struct CENTRY *entries;
-static int numentries;
+static int numentries, allocEntries;
+static int *buckets;
+static int nbuckets;
+/* records in the control file, including those that are superseded */
+static int numrecords;
+/* the control file as we last read it */
+static ino_t control_ino;
+static off_t control_size;
+static bool control_valid;
+/* which file numbers are taken */
+static uchar fileUsed[100000 / 8];
+
+/* Same as sameURL(), no http://, no hash, no .browse suffix */
+static unsigned urlHash(const char *s)
+{
+	const char *p, *u;
+	unsigned h = 2166136261u;
+
+	p = strchr(s, '\1');
+	if (!p)
+		p = s + strlen(s);
+	for (u = p; *u; ++u)
+		h = (h ^ (uchar) * u) * 16777619;
+	if ((u = findHash(s)))
+		p = u;
+	if (memEqualCI(s, "http://", 7))
+		s += 7;
+	if (p - s >= 7 && stringEqual(p - 7, ".browse"))
+		p -= 7;
+	for (; s < p; ++s)
+		h = (h ^ (uchar) * s) * 16777619;
+	return h;
+}
+
+static void useFileNumber(int n)
+{
+	if (n >= 0 && n < 100000)
+		fileUsed[n >> 3] |= (1 << (n & 7));
+}
+
+/* rebuild the hash buckets and the file numbers in use */
+static void indexEntries(void)
+{
+	struct CENTRY *e;
+	int i, n = 64;
+
+	while (n < 2 * allocEntries)
+		n *= 2;
+	if (n != nbuckets) {
+		nzFree(buckets);
+		buckets = allocMem(n * sizeof(int));
+		nbuckets = n;
+	}
+	for (i = 0; i < nbuckets; ++i)
+		buckets[i] = -1;
+	memset(fileUsed, 0, sizeof(fileUsed));
+	e = entries;
+	for (i = 0; i < numentries; ++i, ++e) {
+		int b = e->hash & (nbuckets - 1);
+		e->hnext = buckets[b];
+		buckets[b] = i;
+		useFileNumber(e->filenumber);
+	}
+}
+
+static struct CENTRY *findEntry(const char *url, unsigned h)
+{
+	int i;
+	if (!nbuckets)
+		return 0;
+	for (i = buckets[h & (nbuckets - 1)]; i >= 0; i = entries[i].hnext)
+		if (entries[i].hash == h && sameURL(url, entries[i].url))
+			return entries + i;
+	return 0;
+}
+
+/* new entry for this url, which is allocated, and becomes part of the entry */
+static struct CENTRY *addEntry(char *url, unsigned h)
+{
+	struct CENTRY *e;
+	int b;
+
+	if (numentries == allocEntries) {
+		allocEntries = (allocEntries ? allocEntries * 2 : 256);
+		if (entries)
+			entries =
+			    reallocMem(entries,
+				       allocEntries * sizeof(struct CENTRY));
+		else
+			entries = allocMem(allocEntries * sizeof(struct CENTRY));
+		indexEntries();
+	}
+
+	e = entries + numentries;
+	memset(e, 0, sizeof(struct CENTRY));
+	e->url = url;
+	e->etag = emptyString;
+	e->hash = h;
+	b = h & (nbuckets - 1);
+	e->hnext = buckets[b];
+	buckets[b] = numentries++;
+	return e;
+}
+
+static void dropEntries(void)
+{
+	struct CENTRY *e;
+	int i;
+
+	e = entries;
+	for (i = 0; i < numentries; ++i, ++e) {
+		nzFree(e->url);
+		nzFree(e->etag);
+	}
+	numentries = numrecords = 0;
+	control_valid = false;
+	indexEntries();
+}
 
 void setupEdbrowseCache(void)
 {
 	int fh;
 
+	pthread_mutex_lock(&cache_mutex);
 	if (control_fh >= 0) {
 		close(control_fh);
 		control_fh = -1;
 	}
+#ifndef DOSLIKE
+	if (lock_fh >= 0) {
+		close(lock_fh);
+		lock_fh = -1;
+	}
+#endif
 #ifdef DOSLIKE
 	if (!cacheDir) {
-		if (!ebUserDir)
+		if (!ebUserDir) {
+			pthread_mutex_unlock(&cache_mutex);
 			return;
+		}
 		cacheDir = allocMem(strlen(ebUserDir) + 7);
 		sprintf(cacheDir, "%s/cache", ebUserDir);
 	}
@@ -1989,6 +2152,7 @@ void setupEdbrowseCache(void)
  * Don't have a cache directory and can't creat one; yet we should move on. */
 			free(cacheDir);
 			cacheDir = 0;
+			pthread_mutex_unlock(&cache_mutex);
 			return;
 		}
 	}
@@ -2003,6 +2167,7 @@ void setupEdbrowseCache(void)
  * Don't have a cache directory and can't creat one; yet we should move on. */
 			free(cacheDir);
 			cacheDir = 0;
+			pthread_mutex_unlock(&cache_mutex);
 			return;
 		}
 	}
@@ -2010,129 +2175,224 @@ void setupEdbrowseCache(void)
 
 /* the cache control file, which urls go to which files, and when fetched? */
 	nzFree(cacheControl);
-	cacheControl = allocMem(strlen(cacheDir) + 11);
+	cacheControl = allocMem(strlen(cacheDir) + 15);
 	sprintf(cacheControl, "%s/control%02d", cacheDir, CACHECONTROLVERSION);
 /* make sure the control file exists, just for grins */
-	fh = open(cacheControl, O_WRONLY | O_APPEND | O_CREAT, MODE_private);
+	fh = open(cacheControl, O_WRONLY | O_APPEND | O_CREAT | O_BINARY,
+		  MODE_private);
 	if (fh >= 0)
 		close(fh);
 
 	nzFree(cacheLock);
-	cacheLock = allocMem(strlen(cacheDir) + 6);
-	sprintf(cacheLock, "%s/lock", cacheDir);
+	cacheLock = allocMem(strlen(cacheControl) + 6);
+	sprintf(cacheLock, "%s.lock", cacheControl);
 
 	nzFree(cacheFile);
 	cacheFile = allocMem(strlen(cacheDir) + 7);
 
-	nzFree(entries);
-	entries = allocMem(cacheCount * sizeof(struct CENTRY));
+	dropEntries();
+	pthread_mutex_unlock(&cache_mutex);
 }
 
+/* Parse records out of a piece of the control file that starts at base.
+ * Returns the length of the well formed prefix. */
+static int parseControl(const char *data, int datalen, off_t base)
+{
+	const char *s = data, *endfile = data + datalen;
+	struct CDISK d;
+	struct CENTRY *e;
+	char *url;
+	unsigned h;
+
+	while (endfile - s >= (int)sizeof(d)) {
+		memcpy(&d, s, sizeof(d));
+		if (d.urllen <= 0 || d.etaglen < 0 ||
+		    d.urllen > endfile - s - (int)sizeof(d) ||
+		    d.etaglen > endfile - s - (int)sizeof(d) - d.urllen)
+			break;
+		url = pullString(s + sizeof(d), d.urllen);
+		h = urlHash(url);
+		e = findEntry(url, h);
+		if (e) {
+/* superseded */
+			nzFree(url);
+			nzFree(e->etag);
+		} else {
+			e = addEntry(url, h);
+		}
+		e->etag = pullString(s + sizeof(d) + d.urllen, d.etaglen);
+		e->offset = base + (s - data);
+		e->filenumber = d.filenumber;
+		e->modtime = d.modtime;
+		e->accesstime = d.accesstime;
+		e->pages = d.pages;
+		useFileNumber(d.filenumber);
+		++numrecords;
+		s += sizeof(d) + d.urllen + d.etaglen;
+	}
+
+	return s - data;
+}
+
+static bool writeControl(void);
+
 /*********************************************************************
-Read the control file into memory and parse it into entry structures.
-Sadly, I do this every time you access the cache.
-It would be better to hold all this data in memory, with the time stamp of the
-control file, and if the control file has not been updated
-then just use what we have;
-and if it has been updated then read it and parse it.
-Well maybe we'll implement this later.
-For now, the control file isn't too big, it's not prohibitive
-to do this every time.
-Note that control is a nice ascii readable file, helps with debugging.
+Bring the entries in memory up to date with the control file.
+Most of the time the control file hasn't changed and there is nothing to do.
+If it has grown, read the records at the end.
+If it is a different file, or shorter, then read it all.
+Only a writer, holding the exclusive lock, may repair a bogus file.
 *********************************************************************/
 
-static bool readControl(void)
+static bool readControl(bool writer)
 {
-	char *s, *t, *endfile;
+	struct stat st, st2;
 	char *data;
-	int datalen;
-	struct CENTRY *e;
-	int ln = 1;
+	int datalen, good;
 
-	lseek(control_fh, 0L, 0);
-	if (!fdIntoMemory(control_fh, &data, &datalen))
+/* has someone compacted the file out from under us? */
+	if (control_fh >= 0 && !stat(cacheControl, &st) &&
+	    !fstat(control_fh, &st2) && st.st_ino != st2.st_ino) {
+		close(control_fh);
+		control_fh = -1;
+	}
+	if (control_fh < 0) {
+		control_fh = open(cacheControl, O_RDWR | O_BINARY, 0);
+		if (control_fh < 0)
+			return false;
+	}
+	if (fstat(control_fh, &st))
 		return false;
 
-	numentries = 0;
-	e = entries;
-	endfile = data + datalen;
-	for (s = data; s != endfile; s = t, ++ln) {
-		t = strchr(s, '\n');
-		if (!t) {
-/* file does not end in newline; this should never happen! */
-/* Not sure what to do, but at least it's not a seg fault. */
-			break;
-		}
-		++t;
-		e->offset = s - data;
-		e->textlength = t - s;
-		e->url = s;
-		s = strchr(s, '\t');
-		if (!s || s >= t) {
-			debugPrint(3, "cache control file line %d is bogus",
-				   ln);
-			continue;
-		}
-		*s++ = 0;
-		e->filenumber = strtol(s, &s, 10);
-		++s;
-		e->etag = s;
-		s = strchr(s, '\t');
-		if (!s || s >= t) {
-			debugPrint(3, "cache control file line %d is bogus",
-				   ln);
-			continue;
-		}
-		*s++ = 0;
-		sscanf(s, "%d %d %d", &e->modtime, &e->accesstime, &e->pages);
-		++e, ++numentries;
+	if (control_valid && st.st_ino == control_ino
+	    && st.st_size == control_size)
+		return true;
+
+	if (!control_valid || st.st_ino != control_ino
+	    || st.st_size < control_size) {
+		dropEntries();
+		control_size = 0;
+	}
+
+	lseek(control_fh, control_size, 0);
+	if (!fdIntoMemory(control_fh, &data, &datalen))
+		return false;
+	good = parseControl(data, datalen, control_size);
+	nzFree(data);
+	debugPrint(4, "cache control %d bytes %d entries", datalen,
+		   numentries);
+	control_ino = st.st_ino;
+	control_size += good;
+	control_valid = true;
+
+	if (good < datalen) {
+/* this should never happen! Throw away the junk at the end. */
+		debugPrint(3, "cache control file is bogus at offset %lld",
+			   (long long)control_size);
+		if (writer)
+			return writeControl();
 	}
 
-	cache_data = data;	/* remember to free this later */
 	return true;
 }
 
-/* create an ascii equivalent for a record, this is allocated */
-static char *record2string(const struct CENTRY *e)
+static void record2string(const struct CENTRY *e, char **buf, int *buflen)
+{
+	struct CDISK d;
+	d.filenumber = e->filenumber;
+	d.modtime = e->modtime;
+	d.accesstime = e->accesstime;
+	d.pages = e->pages;
+	d.urllen = strlen(e->url);
+	d.etaglen = strlen(e->etag);
+	stringAndBytes(buf, buflen, (char *)&d, sizeof(d));
+	stringAndBytes(buf, buflen, e->url, d.urllen);
+	stringAndBytes(buf, buflen, e->etag, d.etaglen);
+}
+
+/* Append the record for this entry to the end of the control file. */
+static bool appendControl(struct CENTRY *e)
 {
-	char *t;
-	asprintf(&t, "%s\t%05d\t%s\t%d\t%d\t%d\n",
-		 e->url, e->filenumber, e->etag, e->modtime, e->accesstime,
-		 e->pages);
-	return t;
+	char *buf;
+	int buflen;
+	off_t end;
+	bool rc;
+
+	buf = initString(&buflen);
+	record2string(e, &buf, &buflen);
+	end = lseek(control_fh, 0L, 2);
+	rc = (end >= 0 && write(control_fh, buf, buflen) == buflen);
+	nzFree(buf);
+	if (!rc)
+		return false;
+	e->offset = end;
+	control_size = end + buflen;
+	++numrecords;
+
+/* too many superseded records, time to compact */
+	if (numrecords > 2 * numentries + 100)
+		return writeControl();
+	return true;
 }
 
-/* ON a rare occasion we will have to rewrite the entire control file.
- * If this fails, and it shouldn't, then our only recourse is to clear the cache.
- * If successful, then the file is closed. */
+/* Put the new access time of this entry into the control file. */
+static void touchControl(const struct CENTRY *e)
+{
+	struct CDISK d;
+	lseek(control_fh, e->offset + ((char *)&d.accesstime - (char *)&d), 0);
+	write(control_fh, &e->accesstime, sizeof(d.accesstime));
+}
+
+/* Rewrite the entire control file, one record per entry.
+ * If this fails, and it shouldn't, then our only recourse is to clear the cache. */
 static bool writeControl(void)
 {
 	struct CENTRY *e;
-	int i;
-	FILE *f;
-
-	lseek(control_fh, 0L, 0);
-	truncate0(cacheControl, control_fh);
-/* buffered IO is more efficient */
-	f = fdopen(control_fh, "w");
+	int i, fh;
+	char *buf, *newControl;
+	int buflen;
+	struct stat st;
+	bool rc;
 
+	buf = initString(&buflen);
 	e = entries;
 	for (i = 0; i < numentries; ++i, ++e) {
-		int rc;
-		char *newrec = record2string(e);
-		e->textlength = strlen(newrec);
-		rc = fprintf(f, "%s", newrec);
-		free(newrec);
-		if (rc <= 0) {
-			fclose(f);
-			control_fh = -1;
-			truncate0(cacheControl, -1);
-			return false;
-		}
+		e->offset = buflen;
+		record2string(e, &buf, &buflen);
 	}
 
-	fclose(f);
-	control_fh = -1;
+	newControl = allocMem(strlen(cacheControl) + 5);
+	sprintf(newControl, "%s.new", cacheControl);
+	fh = open(newControl, O_CREAT | O_TRUNC | O_WRONLY | O_BINARY,
+		  MODE_private);
+	rc = (fh >= 0);
+	if (rc) {
+		rc = (write(fh, buf, buflen) == buflen);
+		close(fh);
+	}
+	nzFree(buf);
+#ifdef DOSLIKE
+	if (rc)
+		unlink(cacheControl);
+#endif
+	if (rc)
+		rc = !rename(newControl, cacheControl);
+	if (!rc)
+		unlink(newControl);
+	nzFree(newControl);
+
+	if (control_fh >= 0)
+		close(control_fh);
+	control_fh = open(cacheControl, O_RDWR | O_BINARY, 0);
+	if (!rc || control_fh < 0 || fstat(control_fh, &st)) {
+		control_valid = false;
+		return false;
+	}
+
+	control_ino = st.st_ino;
+	control_size = buflen;
+	control_valid = true;
+	numrecords = numentries;
 	return true;
 }
 
@@ -2141,32 +2401,38 @@ static bool writeControl(void)
  * an unused number in 2 or 3 tries. */
 static int generateFileNumber(void)
 {
-	struct CENTRY *e;
-	int i, n;
+	int n;
 
 	while (true) {
 		n = rand() % 100000;
-		e = entries;
-		for (i = 0; i < numentries; ++i, ++e)
-			if (e->filenumber == n)
-				break;
-		if (i == numentries)
+		if (!(fileUsed[n >> 3] & (1 << (n & 7))))
 			return n;
 	}
 }
 
-/* get exclusive access to the cache */
-static bool setLock(void)
+static void clearLock(void);
+
+/* get access to the cache, shared to look things up,
+ * exclusive to change things */
+static bool setLock(bool exclusive)
 {
+#ifdef DOSLIKE
 	int i;
 	int lock_fh;
 	time_t lock_t;
+#else
+	int i;
+	struct flock fl;
+#endif
 
 	if (!cacheDir)
 		return false;
 	if (!cacheSize)
 		return false;
 
+	pthread_mutex_lock(&cache_mutex);
+
+#ifdef DOSLIKE
 top:
 	time(&now_t);
 
@@ -2176,23 +2442,10 @@ top:
 		    open(cacheLock, O_WRONLY | O_EXCL | O_CREAT, MODE_private);
 		if (lock_fh >= 0) {	/* got it */
 			close(lock_fh);
-			if (control_fh < 0) {
-				control_fh =
-				    open(cacheControl, O_RDWR | O_BINARY, 0);
-				if (control_fh < 0) {
-/* got the lock but couldn't open the database */
-					unlink(cacheLock);
-					return false;
-				}
-			}
-			if (!readControl()) {
-				unlink(cacheLock);
-				return false;
-			}
-			return true;
+			goto locked;
 		}
 		if (errno != EEXIST)
-			return false;
+			goto fail;
 		USLEEP(10000);
 	}
 
@@ -2203,13 +2456,60 @@ top:
 		if (unlink(cacheLock) == 0)
 			goto top;
 	}
+	goto fail;
+
+#else
+
+	time(&now_t);
+	if (lock_fh < 0) {
+		lock_fh = open(cacheLock, O_RDWR | O_CREAT, MODE_private);
+		if (lock_fh < 0)
+			goto fail;
+	}
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = (exclusive ? F_WRLCK : F_RDLCK);
+	fl.l_whence = SEEK_SET;
+/* Try every 10 ms, 100 times, for a total of 1 second, as above.
+ * Don't block in F_SETLKW; SIGINT is installed with signal(),
+ * which restarts the call, so ^c wouldn't get us out,
+ * and a stopped edbrowse holding the lock would hold up everyone.
+ * If we can't get the lock, it's a cache miss. */
+	for (i = 0; i < 100; ++i) {
+		if (fcntl(lock_fh, F_SETLK, &fl) == 0)
+			goto locked;
+		if ((errno != EACCES && errno != EAGAIN) || intFlag)
+			goto fail;
+		USLEEP(10000);
+	}
+	debugPrint(3, "cache lock timeout");
+	goto fail;
+#endif
+
+locked:
+	if (!readControl(exclusive)) {
+/* got the lock but couldn't open or read the database */
+		clearLock();
+		return false;
+	}
+	return true;
 
+fail:
+	pthread_mutex_unlock(&cache_mutex);
 	return false;
 }
 
 static void clearLock(void)
 {
+#ifdef DOSLIKE
 	unlink(cacheLock);
+#else
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fcntl(lock_fh, F_SETLK, &fl);
+#endif
+	pthread_mutex_unlock(&cache_mutex);
 }
 
 /* Remove any cached files and initialize the database */
@@ -2227,19 +2527,19 @@ static void clearCacheInternal(void)
 		unlink(cacheFile);
 	}
 
-	truncate0(cacheControl, -1);
+	truncate0(cacheControl, control_fh);
+	dropEntries();
 }
 
 // This function is not used and has not been tested.
 // Maybe some day it will be invoked from an edbrowse command.
 void clearCache(void)
 {
-	if (!setLock())
+	if (!setLock(true))
 		return;
 	close(control_fh);
 	control_fh = -1;
 	clearCacheInternal();
-	free(cache_data);
 	clearLock();
 }
 
@@ -2259,39 +2559,34 @@ bool fetchCache(const char *url, const char *etag, time_t modtime,
 		char **data, int *data_len)
 {
 	struct CENTRY *e;
-	int i;
-	char *newrec;
-	size_t newlen = 0;
 
 /* you have to give me enough information */
 	if (!modtime && (!etag || !*etag))
 		return false;
 
-	if (!setLock())
+/* A shared lock is enough, even though a hit touches the access time;
+ * that is one field written in place, and a writer can't be compacting. */
+	if (!setLock(false))
 		return false;
 
 /* find the url */
-	e = entries;
-	for (i = 0; i < numentries; ++i, ++e) {
-		if (!sameURL(url, e->url))
-			continue;
+	e = findEntry(url, urlHash(url));
+	if (!e)
+		goto nomatch;
 /* look for match on etag */
-		if (e->etag[0] && etag && etag[0]) {
+	if (e->etag[0] && etag && etag[0]) {
 /* both etags are present */
-			if (stringEqual(etag, e->etag))
-				goto match;
-			goto nomatch;
-		}
-		if (!modtime)
-			goto nomatch;
-		if (modtime / 8 > e->modtime)
-			goto nomatch;
-		goto match;
+		if (stringEqual(etag, e->etag))
+			goto match;
+		goto nomatch;
 	}
-/* url not found */
+	if (!modtime)
+		goto nomatch;
+	if (modtime / 8 > e->modtime)
+		goto nomatch;
+	goto match;
 
 nomatch:
-	free(cache_data);
 	clearLock();
 	return false;
 
@@ -2308,20 +2603,12 @@ match:
 
 /* file has been pulled from cache */
 /* have to update the access time */
-	e->accesstime = now_t / 8;
-	newrec = record2string(e);
-	newlen = strlen(newrec);
-	if (newlen == e->textlength) {
-		lseek(control_fh, e->offset, 0);
-		write(control_fh, newrec, newlen);
-	} else {
-		if (!writeControl())
-			clearCacheInternal();
+	if (e->accesstime != now_t / 8) {
+		e->accesstime = now_t / 8;
+		touchControl(e);
 	}
 
 	debugPrint(3, "from cache");
-	free(newrec);
-	free(cache_data);
 	clearLock();
 	return true;
 }
@@ -2340,22 +2627,11 @@ static int entry_cmp(const void *s, const void *t)
  */
 bool presentInCache(const char *url)
 {
-	bool ret = false;
-	struct CENTRY *e;
-	int i;
+	bool ret;
 
-	if (!setLock())
+	if (!setLock(false))
 		return false;
-
-	e = entries;
-
-	for (i = 0; (!ret && i < numentries); ++i, ++e) {
-		if (!sameURL(url, e->url))
-			continue;
-		ret = true;
-	}
-
-	free(cache_data);
+	ret = (findEntry(url, urlHash(url)) != 0);
 	clearLock();
 	return ret;
 }
@@ -2370,9 +2646,10 @@ void storeCache(const char *url, const char *etag, time_t modtime,
 	struct CENTRY *e;
 	int i;
 	int filenum;
-	bool append = false;
+	unsigned h;
+	bool append = true;
 
-	if (!setLock())
+	if (!setLock(true))
 		return;
 
 /* leading http:// is the default, and not needed in the control file.
@@ -2381,13 +2658,10 @@ void storeCache(const char *url, const char *etag, time_t modtime,
 		url += 7;
 
 /* find the url */
-	e = entries;
-	for (i = 0; i < numentries; ++i, ++e) {
-		if (sameURL(url, e->url))
-			break;
-	}
+	h = urlHash(url);
+	e = findEntry(url, h);
 
-	if (i < numentries)
+	if (e)
 		filenum = e->filenumber;
 	else
 		filenum = generateFileNumber();
@@ -2397,52 +2671,34 @@ void storeCache(const char *url, const char *etag, time_t modtime,
 /* oops, can't write the file */
 		unlink(cacheFile);
 		debugPrint(3, "cannot write web page into cache");
-		free(cache_data);
 		clearLock();
 		return;
 	}
 
-	if (i < numentries) {
-		char *newrec;
-		size_t newlen;
+	if (e) {
 /* we're just updating a preexisting record */
 		e->accesstime = now_t / 8;
 		e->modtime = modtime / 8;
-		e->etag = (etag ? etag : emptyString);
+		nzFree(e->etag);
+		e->etag = cloneString(etag ? etag : emptyString);
 		e->pages = (datalen + 4095) / 4096;
-		newrec = record2string(e);
-		newlen = strlen(newrec);
-		if (newlen == e->textlength) {
-/* record is the same length, just update it */
-			lseek(control_fh, e->offset, 0);
-			write(control_fh, newrec, newlen);
-			debugPrint(3, "into cache");
-			free(cache_data);
-			free(newrec);
-			clearLock();
-			return;
-		}
-
-/* Record has changed length, have to rewrite the whole control file */
-		e->textlength = newlen;
-		if (!writeControl())
-			clearCacheInternal();
-		else
-			debugPrint(3, "into cache");
-		free(cache_data);
-		clearLock();
-		return;
+		goto write;
 	}
 
 /* this file is new. See if the database is full. */
-	append = true;
 	if (numentries >= 140) {
 		int npages = 0;
 		e = entries;
 		for (i = 0; i < numentries; ++i, ++e)
 			npages += e->pages;
 
-		if (numentries == cacheCount || npages / 256 >= cacheSize) {
+		if (numentries >= cacheCount || npages / 256 >= cacheSize) {
+/* get the latest access times from the other edbrowse processes */
+			control_valid = false;
+			if (!readControl(true)) {
+				clearLock();
+				return;
+			}
 /* sort to find the 100 oldest files */
 			qsort(entries, numentries, sizeof(struct CENTRY),
 			      entry_cmp);
@@ -2453,40 +2709,28 @@ void storeCache(const char *url, const char *etag, time_t modtime,
 				sprintf(cacheFile, "%s/%05d", cacheDir,
 					e->filenumber);
 				unlink(cacheFile);
+				nzFree(e->url);
+				nzFree(e->etag);
 			}
 			numentries -= 100;
+			indexEntries();
 			append = false;
 		}
 	}
 
-	e = entries + numentries;
-	++numentries;
-	e->url = url;
+	e = addEntry(cloneString(url), h);
 	e->filenumber = filenum;
-	e->etag = (etag ? etag : emptyString);
+	e->etag = cloneString(etag ? etag : emptyString);
 	e->accesstime = now_t / 8;
 	e->modtime = modtime / 8;
 	e->pages = (datalen + 4095) / 4096;
+	useFileNumber(filenum);
 
-	if (append) {
-/* didn't have to prune; just append this record */
-		char *newrec = record2string(e);
-		e->textlength = strlen(newrec);
-		lseek(control_fh, 0L, 2);
-		write(control_fh, newrec, e->textlength);
+write:
+	if (append ? appendControl(e) : writeControl())
 		debugPrint(3, "into cache");
-		free(cache_data);
-		free(newrec);
-		clearLock();
-		return;
-	}
-
-/* have to rewrite the whole control file */
-	if (!writeControl())
-		clearCacheInternal();
 	else
-		debugPrint(3, "into cache");
-	free(cache_data);
+		clearCacheInternal();
 	clearLock();
 }
 
@@ -1560,8 +1560,7 @@ static duk_ret_t nat_fetchHTTP(duk_context * cx)
 		t->innerHTML = cloneString(incoming_headers);
 		if (cw->browseMode)
 			scriptSetsTimeout(t);
-		pthread_create(&t->loadthread, NULL, httpConnectBack3,
-			       (void *)t);
+		fetchSubmit(t, httpConnectBack3, FETCH_ASYNC);
 		duk_push_string(cx, "async");
 		return 1;
 	}
@@ -1574,7 +1573,6 @@ static duk_ret_t nat_fetchHTTP(duk_context * cx)
 	g.headers_p = &outgoing_xhrheaders;
 	rc = httpConnect(&g);
 	outgoing_xhrbody = g.buffer;
-	nzFree(a);
 	if (intFlag) {
 		duk_get_global_string(cx, "eb$stopexec");
 // this next line should fail and stop the script!
@@ -1586,15 +1584,22 @@ static duk_ret_t nat_fetchHTTP(duk_context * cx)
 		outgoing_xhrheaders = emptyString;
 	if (outgoing_xhrbody == NULL)
 		outgoing_xhrbody = emptyString;
-	duk_pop_n(cx, 4);
-	duk_push_string(cx, "");
-	duk_push_string(cx, "\r\n\r\n");
-	duk_push_int(cx, rc);
+// Hand back the pieces separately, see xml_parse in shared.js
+	duk_push_this(cx);
+	duk_push_boolean(cx, rc);
+	duk_put_prop_string(cx, -2, "$success");
 	duk_push_int(cx, g.code);
+	duk_put_prop_string(cx, -2, "$code");
+	duk_push_string(cx, (g.cfn ? g.cfn : incoming_url));
+	duk_put_prop_string(cx, -2, "$url");
 	duk_push_string(cx, outgoing_xhrheaders);
-	duk_join(cx, 3);
+	duk_put_prop_string(cx, -2, "$headers");
 	duk_push_string(cx, outgoing_xhrbody);
-	duk_join(cx, 2);
+	duk_put_prop_string(cx, -2, "responseText");
+	duk_pop_n(cx, 5);
+	duk_push_string(cx, "sync");
+	nzFree(a);
+	nzFree(g.cfn);
 	nzFree(outgoing_xhrheaders);
 	nzFree(outgoing_xhrbody);
 
@@ -3422,6 +3427,17 @@ void set_property_string_t(const Tag *t, const char *name, const char * v)
 	set_property_string_0(t->f0->cx, t->jv, name, v);
 }
 
+// duktape interns every property name anyway; nothing to gain from a table.
+void set_hotprop_string_t(const Tag *t, enum hotprop p, const char * v)
+{
+	set_property_string_t(t, hotPropNames[p], v);
+}
+
+void set_hotprop_bool_t(const Tag *t, enum hotprop p, bool v)
+{
+	set_property_bool_t(t, hotPropNames[p], v);
+}
+
 void set_dataset_string_t(const Tag *t, const char *name, const char *v)
 {
 	jsobjtype dso; // dataset object
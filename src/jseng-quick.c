@@ -14,6 +14,10 @@ along with the GPL, general public license, for edbrowse.
 #include "vsprtf.h"
 #endif // DOSLIKE
 
+#ifdef _MSC_VER
+extern int gettimeofday(struct timeval *tp, void *tzp);	// from tidys.lib
+#endif // _MSC_VER
+
 // the makefile should set -I properly, based on  your environment variable
 // QUICKJS_DIR, or using a reasonable default.
 // So this basic include should work.
@@ -160,6 +164,21 @@ static bool run_event(JSContext *cx, JSValueConst obj, const char *pname, const
 // and these are global and can be called from outside.
 // Other wrappers end in _win for window or _doc for document.
 
+/*********************************************************************
+Property names like value, checked, class, and nodeName are read and written
+thousands of times per page, by domLink, jSyncup, and decorate.
+JS_GetPropertyStr and JS_SetPropertyStr atomize the name on every call,
+a hash and a probe of the atom table, and then throw the atom away.
+These names are atomized once, in js_main; atoms belong to the runtime,
+not the context, so the table serves every window.
+The level 0 routines take an atom, ending in _a,
+and the versions that take a string are wrappers around them.
+Since atoms are unique, a name can be recognized by comparing atoms.
+*********************************************************************/
+
+static JSAtom hotatoms[HP_MAX];
+#define hotatom(p) hotatoms[HP_##p]
+
 // determine the type of the element managed by JSValue
 static enum ej_proptype top_proptype(JSContext *cx, JSValueConst v)
 {
@@ -185,15 +204,23 @@ static enum ej_proptype top_proptype(JSContext *cx, JSValueConst v)
 	return EJ_PROP_NONE;	// don't know
 }
 
-static enum ej_proptype typeof_property(JSContext *cx, JSValueConst parent, const char *name)
+static enum ej_proptype typeof_property_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	enum ej_proptype l = top_proptype(cx, v);
 	grab(v);
 	JS_Release(cx, v);
 	return l;
 }
 
+static enum ej_proptype typeof_property(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	enum ej_proptype l = typeof_property_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return l;
+}
+
 enum ej_proptype typeof_property_t(const Tag *t, const char *name)
 {
 if(!t->jslink || !allowJS)
@@ -203,9 +230,9 @@ return typeof_property(t->f0->cx, *((JSValue*)t->jv), name);
 
 /* Return a property as a string, if it is
  * string compatible. The string is allocated, free it when done. */
-static char *get_property_string(JSContext *cx, JSValueConst parent, const char *name)
+static char *get_property_string_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	const char *s;
 	char *s0 = NULL;
 	enum ej_proptype proptype = top_proptype(cx, v);
@@ -221,6 +248,14 @@ static char *get_property_string(JSContext *cx, JSValueConst parent, const char
 	return s0;
 }
 
+static char *get_property_string(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	char *s0 = get_property_string_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return s0;
+}
+
 char *get_property_string_t(const Tag *t, const char *name)
 {
 if(!t->jslink || !allowJS)
@@ -228,9 +263,9 @@ return 0;
 return get_property_string(t->f0->cx, *((JSValue*)t->jv), name);
 }
 
-static bool get_property_bool(JSContext *cx, JSValue parent, const char *name)
+static bool get_property_bool_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	bool b = false;
 	grab(v);
 	if(JS_IsBool(v))
@@ -245,6 +280,14 @@ static bool get_property_bool(JSContext *cx, JSValue parent, const char *name)
 	return b;
 }
 
+static bool get_property_bool(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	bool b = get_property_bool_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return b;
+}
+
 bool get_property_bool_t(const Tag *t, const char *name)
 {
 if(!t->jslink || !allowJS)
@@ -252,9 +295,9 @@ return false;
 return get_property_bool(t->f0->cx, *((JSValue*)t->jv), name);
 }
 
-static int get_property_number(JSContext *cx, JSValueConst parent, const char *name)
+static int get_property_number_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	int32_t n = -1;
 	grab(v);
 	if(JS_IsNumber(v))
@@ -264,6 +307,14 @@ static int get_property_number(JSContext *cx, JSValueConst parent, const char *n
 	return n;
 }
 
+static int get_property_number(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	int n = get_property_number_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return n;
+}
+
 int get_property_number_t(const Tag *t, const char *name)
 {
 if(!t->jslink || !allowJS)
@@ -275,9 +326,9 @@ return get_property_number(t->f0->cx, *((JSValue*)t->jv), name);
 // should this return 0 for null, which is tehcnically an object?
 // How bout function or array?
 // The object returned is a duplicate and must be freed.
-static JSValue get_property_object(JSContext *cx, JSValueConst parent, const char *name)
+static JSValue get_property_object_a(JSContext *cx, JSValueConst parent, JSAtom a)
 {
-	JSValue v = JS_GetPropertyStr(cx, parent, name);
+	JSValue v = JS_GetProperty(cx, parent, a);
 	grab(v);
 	if(JS_IsObject(v))
 		return v;
@@ -285,12 +336,20 @@ static JSValue get_property_object(JSContext *cx, JSValueConst parent, const cha
 	return JS_UNDEFINED;
 }
 
+static JSValue get_property_object(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	JSValue v = get_property_object_a(cx, parent, a);
+	JS_FreeAtom(cx, a);
+	return v;
+}
+
 // return -1 for error
 static int get_arraylength(JSContext *cx, JSValueConst a)
 {
 	if(!JS_IsArray(cx, a))
 		return -1;
-	return get_property_number(cx, a, "length");
+	return get_property_number_a(cx, a, hotatom(LENGTH));
 }
 
 // quick seems to have no direct way to access a.length or a[i],
@@ -405,7 +464,7 @@ static JSValue setter_innerHTML(JSContext * cx, JSValueConst this, int argc, JSV
 		return JS_UNDEFINED;
 	debugPrint(5, "setter h in");
 // remove the preexisting children.
-	c1 = JS_GetPropertyStr(cx, this, "childNodes");
+	c1 = JS_GetProperty(cx, this, hotatom(CHILDNODES));
 	grab(c1);
 	if(!JS_IsArray(cx, c1)) {
 // no child nodes array, don't do anything.
@@ -418,8 +477,8 @@ static JSValue setter_innerHTML(JSContext * cx, JSValueConst this, int argc, JSV
 // make new childNodes array
 	c2 = JS_NewArray(cx);
 	grab(c2);
-	JS_SetPropertyStr(cx, this, "childNodes", JS_DupValue(cx, c2));
-	JS_SetPropertyStr(cx, this, "inner$HTML", JS_NewAtomString(cx, h));
+	JS_SetProperty(cx, this, hotatom(CHILDNODES), JS_DupValue(cx, c2));
+	JS_SetProperty(cx, this, hotatom(INNER_HTML), JS_NewString(cx, h));
 
 // Put some tags around the html, so tidy can parse it.
 	run = initString(&run_l);
@@ -473,7 +532,7 @@ static JSValue setter_value(JSContext * cx, JSValueConst this, int argc, JSValue
 	if (!h)			// should never happen
 		return JS_UNDEFINED;
 	debugPrint(5, "setter v in");
-	JS_SetPropertyStr(cx, this, "val$ue", JS_NewAtomString(cx, h));
+	JS_SetPropertyStr(cx, this, "val$ue", JS_NewString(cx, h));
 	k = cloneString(h);
 	prepareForField(k);
 	JS_FreeCString(cx, h);
@@ -487,46 +546,54 @@ static JSValue setter_value(JSContext * cx, JSValueConst this, int argc, JSValue
 	return JS_UNDEFINED;
 }
 
-static void set_property_string(JSContext *cx, JSValueConst parent, const char *name,
+static void set_property_string_a(JSContext *cx, JSValueConst parent, JSAtom a,
 			    const char *value)
 {
 	bool defset = false;
 	JSCFunction *getter = 0;
 	JSCFunction *setter = 0;
-	const char *altname;
-	if (stringEqual(name, "innerHTML"))
+	JSAtom altname;
+	if (a == hotatom(INNERHTML))
 		getter = getter_innerHTML,
 		setter = setter_innerHTML,
-		    altname = "inner$HTML";
-	if (stringEqual(name, "value")) {
+		    altname = hotatom(INNER_HTML);
+	if (a == hotatom(VALUE)) {
 // Only meaningful in the Element class
-		JSValue dc = JS_GetPropertyStr(cx, parent, "dom$class");
+		JSValue dc = JS_GetProperty(cx, parent, hotatom(DOMCLASS));
 		const char *dcs = JS_ToCString(cx, dc);
 		grab(dc);
 		if(stringEqual(dcs, "HTMLInputElement") ||
 		stringEqual(dcs, "HTMLTextAreaElement"))
 			getter = getter_value,
 			setter = setter_value,
-			    altname = "val$ue";
+			    altname = hotatom(VAL_UE);
 		JS_FreeCString(cx, dcs);
 		JS_Release(cx, dc);
 	}
 	if (setter) {
 // see if we already did this - does the property show up as a string?
-		if(typeof_property(cx, parent, name) != EJ_PROP_STRING)
+		if(typeof_property_a(cx, parent, a) != EJ_PROP_STRING)
 			defset = true;
 	}
 	if (defset) {
-		JSAtom a = JS_NewAtom(cx, name);
 		JS_DefinePropertyGetSet(cx, parent, a,
 		JS_NewCFunction(cx, getter, "get", 0),
 		JS_NewCFunction(cx, setter, "set", 0),
 		JS_PROP_ENUMERABLE);
-		JS_FreeAtom(cx, a);
 	}
 	if (!value)
 		value = emptyString;
-	JS_SetPropertyStr(cx, parent, (setter ? altname : name), JS_NewAtomString(cx, value));
+// Not JS_NewAtomString; values can be whole scripts or pages,
+// and they have no business in the atom table.
+	JS_SetProperty(cx, parent, (setter ? altname : a), JS_NewString(cx, value));
+}
+
+static void set_property_string(JSContext *cx, JSValueConst parent, const char *name,
+			    const char *value)
+{
+	JSAtom a = JS_NewAtom(cx, name);
+	set_property_string_a(cx, parent, a, value);
+	JS_FreeAtom(cx, a);
 }
 
 void set_property_string_t(const Tag *t, const char *name, const char * v)
@@ -536,6 +603,13 @@ void set_property_string_t(const Tag *t, const char *name, const char * v)
 	set_property_string(t->f0->cx, *((JSValue*)t->jv), name, v);
 }
 
+void set_hotprop_string_t(const Tag *t, enum hotprop p, const char * v)
+{
+	if(!t->jslink || !allowJS)
+		return;
+	set_property_string_a(t->f0->cx, *((JSValue*)t->jv), hotatoms[p], v);
+}
+
 void set_property_string_win(const Frame *f, const char *name, const char *v)
 {
 	set_property_string(f->cx, *((JSValue*)f->winobj), name, v);
@@ -546,6 +620,11 @@ void set_property_string_doc(const Frame *f, const char *name, const char *v)
 	set_property_string(f->cx, *((JSValue*)f->docobj), name, v);
 }
 
+static void set_property_bool_a(JSContext *cx, JSValueConst parent, JSAtom a, bool n)
+{
+	JS_SetProperty(cx, parent, a, JS_NewBool(cx, n));
+}
+
 static void set_property_bool(JSContext *cx, JSValueConst parent, const char *name, bool n)
 {
 	JS_SetPropertyStr(cx, parent, name, JS_NewBool(cx, n));
@@ -558,6 +637,13 @@ void set_property_bool_t(const Tag *t, const char *name, bool v)
 	set_property_bool(t->f0->cx, *((JSValue*)t->jv), name, v);
 }
 
+void set_hotprop_bool_t(const Tag *t, enum hotprop p, bool v)
+{
+	if(!t->jslink || !allowJS)
+		return;
+	set_property_bool_a(t->f0->cx, *((JSValue*)t->jv), hotatoms[p], v);
+}
+
 void set_property_bool_win(const Frame *f, const char *name, bool v)
 {
 	set_property_bool(f->cx, *((JSValue*)f->winobj), name, v);
@@ -571,6 +657,11 @@ void set_property_object_doc(const Frame *f, const char *name, const Tag *t2)
 	set_property_object(f->cx, *((JSValue*)f->docobj), name, *((JSValue*)t2->jv));
 }
 
+static void set_property_number_a(JSContext *cx, JSValueConst parent, JSAtom a, int n)
+{
+	JS_SetProperty(cx, parent, a, JS_NewInt32(cx, n));
+}
+
 static void set_property_number(JSContext *cx, JSValueConst parent, const char *name, int n)
 {
 	JS_SetPropertyStr(cx, parent, name, JS_NewInt32(cx, n));
@@ -585,6 +676,11 @@ void set_property_number_t(const Tag *t, const char *name, int v)
 
 // the next two functions duplicate the object value;
 // you are still responsible for the original.
+static void set_property_object_a(JSContext *cx, JSValueConst parent, JSAtom a, JSValueConst child)
+{
+	JS_SetProperty(cx, parent, a, JS_DupValue(cx, child));
+}
+
 static void set_property_object(JSContext *cx, JSValueConst parent, const char *name, JSValueConst child)
 {
 	JS_SetPropertyStr(cx, parent, name, JS_DupValue(cx, child));
@@ -646,12 +742,20 @@ void delete_property_doc(const Frame *f, const char *name)
 	delete_property(f->cx, *((JSValue*)f->docobj), name);
 }
 
-static JSValue instantiate_array(JSContext *cx, JSValueConst parent, const char *name)
+static JSValue instantiate_array_a(JSContext *cx, JSValueConst parent, JSAtom name)
 {
 	debugPrint(5, "new Array");
 	JSValue a = JS_NewArray(cx);
 	grab(a);
-	set_property_object(cx, parent, name, a);
+	set_property_object_a(cx, parent, name, a);
+	return a;
+}
+
+static JSValue instantiate_array(JSContext *cx, JSValueConst parent, const char *name)
+{
+	JSAtom n = JS_NewAtom(cx, name);
+	JSValue a = instantiate_array_a(cx, parent, n);
+	JS_FreeAtom(cx, n);
 	return a;
 }
 
@@ -902,7 +1006,7 @@ static void run_function_onestring(JSContext *cx, JSValueConst parent, const cha
 		JS_Release(cx, v);
 		return;
 	}
-	l[0] = JS_NewAtomString(cx, s);
+	l[0] = JS_NewString(cx, s);
 	grab(l[0]);
 	r = JS_Call(cx, v, parent, 1, l);
 	grab(r);
@@ -1354,8 +1458,8 @@ static void connectTagObject(Tag *t, JSValue p)
 // Below a frame, t could be a manufactured document for the new window.
 // We don't want to set eb$seqno in this case.
 	if(t->action != TAGACT_DOC) {
-		JS_DefinePropertyValueStr(cx, p, "eb$seqno", JS_NewInt32(cx, t->seqno), 0);
-		JS_DefinePropertyValueStr(cx, p, "eb$gsn", JS_NewInt32(cx, t->gsn), 0);
+		JS_DefinePropertyValue(cx, p, hotatom(SEQNO), JS_NewInt32(cx, t->seqno), 0);
+		JS_DefinePropertyValue(cx, p, hotatom(GSN), JS_NewInt32(cx, t->gsn), 0);
 	}
 }
 
@@ -1486,7 +1590,7 @@ static JSValue nat_btoa(JSContext * cx, JSValueConst this, int argc, JSValueCons
 	}
 	t = base64Encode(s, len, false);
 	nzFree(s);
-	v = JS_NewAtomString(cx, t);
+	v = JS_NewString(cx, t);
 	nzFree(t);
 	return v;
 }
@@ -2404,7 +2508,7 @@ static bool append0(JSContext * cx, JSValueConst this, int argc, JSValueConst *a
 
 	debugPrint(5, "append in");
 	child = argv[0];
-	cn = JS_GetPropertyStr(cx, this, "childNodes");
+	cn = JS_GetProperty(cx, this, hotatom(CHILDNODES));
 	grab(cn);
 	if(!JS_IsArray(cx, cn))
 		goto done;
@@ -2473,7 +2577,7 @@ static JSValue nat_insbf(JSContext * cx, JSValueConst this, int argc, JSValueCon
 	debugPrint(5, "before in");
 	child = argv[0];
 	item = argv[1];
-	cn = JS_GetPropertyStr(cx, this, "childNodes");
+	cn = JS_GetProperty(cx, this, hotatom(CHILDNODES));
 	grab(cn);
 	if(!JS_IsArray(cx, cn))
 		goto done;
@@ -2531,7 +2635,7 @@ static JSValue nat_rmch2(JSContext * cx, JSValueConst this, int argc, JSValueCon
 	if (!JS_IsObject(argv[0]))
 		return JS_NULL;
 	child = argv[0];
-	cn = JS_GetPropertyStr(cx, this, "childNodes");
+	cn = JS_GetProperty(cx, this, hotatom(CHILDNODES));
 	grab(cn);
 	if(!JS_IsArray(cx, cn))
 		goto fail;
@@ -2604,9 +2708,6 @@ static JSValue nat_fetchHTTP(JSContext * cx, JSValueConst this, int argc, JSValu
 	char *outgoing_xhrbody = NULL;
 	char *a;
 	bool rc, async;
-	char *s;
-	int s_l;
-	JSValue u;
 	int32_t pd; // process the data
 	bool dopost = false;
 
@@ -2669,8 +2770,7 @@ static JSValue nat_fetchHTTP(JSContext * cx, JSValueConst this, int argc, JSValu
 		JS_FreeCString(cx, incoming_headers);
 		if (cw->browseMode)
 			scriptSetsTimeout(t);
-		pthread_create(&t->loadthread, NULL, httpConnectBack3,
-			       (void *)t);
+		fetchSubmit(t, httpConnectBack3, FETCH_ASYNC);
 		return JS_NewAtomString(cx, "async");
 	}
 
@@ -2682,30 +2782,27 @@ static JSValue nat_fetchHTTP(JSContext * cx, JSValueConst this, int argc, JSValu
 	g.headers_p = &outgoing_xhrheaders;
 	rc = httpConnect(&g);
 	outgoing_xhrbody = g.buffer;
-	cnzFree(incoming_url);
 	JS_FreeCString(cx, incoming_headers);
 	if (outgoing_xhrheaders == NULL)
 		outgoing_xhrheaders = emptyString;
 	if (outgoing_xhrbody == NULL)
 		outgoing_xhrbody = emptyString;
-	s = initString(&s_l);
-	stringAndNum(&s, &s_l, rc);
-	stringAndString(&s, &s_l, "\r\n\r\n");
-	stringAndNum(&s, &s_l, g.code);
-	stringAndString(&s, &s_l, "\r\n\r\n");
-	stringAndString(&s, &s_l, g.cfn ? g.cfn : incoming_url);
-	stringAndString(&s, &s_l, "\r\n\r\n");
-	stringAndString(&s, &s_l, outgoing_xhrheaders);
-	stringAndString(&s, &s_l, outgoing_xhrbody);
+// Hand back the pieces separately, rather than one string
+// that javascript has to split apart again.
+// The body could be megabytes, so it is a plain string, not an atom.
+	set_property_bool(cx, this, "$success", rc);
+	set_property_number(cx, this, "$code", g.code);
+	set_property_string(cx, this, "$url", (g.cfn ? g.cfn : incoming_url));
+	set_property_string(cx, this, "$headers", outgoing_xhrheaders);
+	set_property_string(cx, this, "responseText", outgoing_xhrbody);
+	cnzFree(incoming_url);
 	nzFree(outgoing_xhrheaders);
 	nzFree(outgoing_xhrbody);
 	nzFree(g.cfn);
 	nzFree(g.referrer);
 
 	debugPrint(5, "xhr out");
-	u = JS_NewAtomString(cx, s);
-	nzFree(s);
-	return u;
+	return JS_NewAtomString(cx, "sync");
 }
 
 static JSValue nat_resolveURL(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
@@ -2789,7 +2886,7 @@ static void startCookie(void)
 static JSValue nat_getcook(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
 {
 	startCookie();
-	return JS_NewAtomString(cx, cookieCopy);
+	return JS_NewString(cx, cookieCopy);
 }
 
 static JSValue nat_setcook(JSContext * cx, JSValueConst this, int argc, JSValueConst *argv)
@@ -3234,6 +3331,40 @@ static JSValue nat_jobs(JSContext * cx, JSValueConst this, int argc, JSValueCons
 	return JS_UNDEFINED;
 }
 
+/*********************************************************************
+shared.js and startwindow.js are compiled to bytecode at build time,
+by buildbytecode.c.
+startwindow.js runs for every window and every frame, and reading
+bytecode is much faster than parsing 2,400 lines of javascript.
+The bytecode is empty if the scripts contain breakpoints,
+and JS_ReadObject rejects bytecode from a different version of quick js;
+either way we return false and the caller falls back on the source.
+*********************************************************************/
+
+static bool runBytecode(JSContext *cx, const unsigned char *bc, size_t len,
+const char *filename)
+{
+	JSValue fn, r;
+	if (!len)
+		return false;
+	fn = JS_ReadObject(cx, bc, len, JS_READ_OBJ_BYTECODE);
+	if (JS_IsException(fn)) {
+		JSValue e = JS_GetException(cx);
+		JS_FreeValue(cx, e);
+		debugPrint(3, "cannot read the bytecode for %s, using the source", filename);
+		return false;
+	}
+	jsSourceFile = filename;
+	jsLineno = 1;
+// JS_EvalFunction consumes fn
+	r = JS_EvalFunction(cx, fn);
+	if(JS_IsException(r))
+		processError(cx);
+	JS_FreeValue(cx, r);
+	jsSourceFile = 0;
+	return true;
+}
+
 /*********************************************************************
 There is a serious stackoverflow bug,
 that I don't have time or space to describe here.
@@ -3249,6 +3380,7 @@ void js_main(void)
 {
 JSValue mwo; // master window object
 	JSValue r;
+	int i;
 	if(js_running)
 		return;
 	debugPrint(3, "JSRuntimeJobIndex is %d", JSRuntimeJobIndex);
@@ -3264,6 +3396,8 @@ JSValue mwo; // master window object
 		JS_SetMaxStackSize(jsrt, 2048*1024);
 	mwc = JS_NewContext(jsrt);
 	mwo = JS_GetGlobalObject(mwc);
+	for (i = 0; i < HP_MAX; ++i)
+		hotatoms[i] = JS_NewAtom(mwc, hotPropNames[i]);
 #if SHARECLASS
 /*********************************************************************
 Why put native functions in the master window, to be shared?
@@ -3333,6 +3467,8 @@ JS_NewCFunction(mwc, nat_jobs, "jobspending", 0), JS_PROP_ENUMERABLE);
 #endif
 
 // shared functions and classes
+	if(runBytecode(mwc, sharedBC, sharedBC_len, "shared.js"))
+		goto demin;
 	jsSourceFile = "shared.js";
 	jsLineno = 1;
 
@@ -3381,6 +3517,7 @@ JS_NewCFunction(mwc, nat_jobs, "jobspending", 0), JS_PROP_ENUMERABLE);
 	if(JS_IsException(r))
 		processError(mwc);
 	JS_FreeValue(mwc, r);
+demin:
 	jsSourceFile = "demin.js";
 	r = JS_Eval(mwc, deminJS, strlen(deminJS),
 	jsSourceFile, JS_EVAL_TYPE_GLOBAL);
@@ -3550,8 +3687,10 @@ JS_NewCFunction(cx, nat_rmch2, "removeChild", 1), 0);
 }
 
 static void setup_window_2(void);
+static bool swBytecode;	// startwindow.js was run from bytecode
 void createJSContext(Frame *f)
 {
+	struct timeval tv0, tv1;
 	if (!allowJS)
 		return;
 	js_main();
@@ -3559,10 +3698,16 @@ void createJSContext(Frame *f)
 		i_puts(MSG_JSEngineRun);
 		return;
 	}
+// time the setup, to measure the bytecode against the source
+	gettimeofday(&tv0, NULL);
 	createJSContext_0(f);
 	if (f->cx) {
 		f->jslink = true;
 		setup_window_2();
+		gettimeofday(&tv1, NULL);
+		debugPrint(4, "context %d created in %ld usec from %s", f->gsn,
+		(long)(tv1.tv_sec - tv0.tv_sec) * 1000000 + (tv1.tv_usec - tv0.tv_usec),
+		(swBytecode ? "bytecode" : "source"));
 	} else {
 		i_puts(MSG_JavaContextError);
 	}
@@ -3602,7 +3747,9 @@ static void setup_window_2(void)
 /* the js window/document setup script.
  * These are all the things that do not depend on the platform,
  * OS, configurations, etc. */
-	jsRunScriptWin(startWindowJS, "startwindow.js", 1);
+	swBytecode = runBytecode(cx, startWindowBC, startWindowBC_len, "startwindow.js");
+	if(!swBytecode)
+		jsRunScriptWin(startWindowJS, "startwindow.js", 1);
 
 	nav = get_property_object(cx, w, "navigator");
 	if (JS_IsUndefined(nav))
@@ -3746,7 +3893,7 @@ void establish_js_option(Tag *t, Tag *sel)
 		set_property_object(cx, oo, "form", fo);
 		JS_Release(cx, fo);
 	}
-	cn = instantiate_array(cx, oo, "childNodes");
+	cn = instantiate_array_a(cx, oo, hotatom(CHILDNODES));
 
 connectTagObject(t, oo);
 
@@ -3759,7 +3906,7 @@ void establish_js_textnode(Tag *t, const char *fpn)
 	JSContext *cx = cf->cx;
 	JSValue cn;
 	 JSValue tagobj = instantiate(cx, *((JSValue*)cf->winobj), fpn, "TextNode");
-	cn = instantiate_array(cx, tagobj, "childNodes");
+	cn = instantiate_array_a(cx, tagobj, hotatom(CHILDNODES));
 	connectTagObject(t, tagobj);
 	JS_Release(cx, cn);
 }
@@ -3908,11 +4055,11 @@ That's how it was for a long time, but I think we only do this on form.
 			if(JS_IsUndefined(io))
 				return;
 // Not an array; needs the childNodes array beneath it for the children.
-			ca = instantiate_array(cx, io, "childNodes");
+			ca = instantiate_array_a(cx, io, hotatom(CHILDNODES));
 // childNodes and options are the same for Select and datalist
 			if (stringEqual(classname, "HTMLSelectElement") ||
 			stringEqual(classname, "Datalist"))
-				set_property_object(cx, io, "options", ca);
+				set_property_object_a(cx, io, hotatom(OPTIONS), ca);
 			JS_Release(cx, ca);
 		}
 
@@ -3921,7 +4068,7 @@ call out to process those and add them to the object.
 Don't do any of this if the tag is itself <style>. */
 		if (stylestring && t->action != TAGACT_STYLE) {
 // This call creates the styl object on demand.
-			JSValue so = get_property_object(cx, io, "style");
+			JSValue so = get_property_object_a(cx, io, hotatom(STYLE));
 			processStyles(so, stylestring);
 			JS_Release(cx, so);
 		}
@@ -3930,9 +4077,9 @@ Don't do any of this if the tag is itself <style>. */
  * aren't populated at domLink-time */
 		if (!tcn)
 			tcn = emptyString;
-		set_property_string(cx, io, "class", tcn);
-		set_property_string(cx, io, "last$class", tcn);
-		set_property_object(cx, io, "ownerDocument", *((JSValue*)cf->docobj));
+		set_property_string_a(cx, io, hotatom(CLASS), tcn);
+		set_property_string_a(cx, io, hotatom(LASTCLASS), tcn);
+		set_property_object_a(cx, io, hotatom(OWNERDOCUMENT), *((JSValue*)cf->docobj));
 
 // only anchors with href go into links[]
 		if (list && stringEqual(list, "links") &&
@@ -3968,9 +4115,9 @@ Don't do any of this if the tag is itself <style>. */
 		io = ca;
 	}
 
-	set_property_string(cx, io, "name", (symname ? symname : emptyString));
-	set_property_string(cx, io, "id", (idname ? idname : emptyString));
-	set_property_string(cx, io, "last$id", (idname ? idname : emptyString));
+	set_property_string_a(cx, io, hotatom(NAME), (symname ? symname : emptyString));
+	set_property_string_a(cx, io, hotatom(ID), (idname ? idname : emptyString));
+	set_property_string_a(cx, io, hotatom(LASTID), (idname ? idname : emptyString));
 
 	if (href && href_url)
 // This use to be instantiate_url, but with the new side effects
@@ -3979,16 +4126,16 @@ Don't do any of this if the tag is itself <style>. */
 
 	if (t->action == TAGACT_INPUT) {
 /* link back to the form that owns the element */
-		set_property_object(cx, io, "form", owner);
+		set_property_object_a(cx, io, hotatom(FORM), owner);
 	}
 
 	strcpy(upname, t->info->name);
 	caseShift(upname, 'u');
 // DocType has nodeType = 10, see startwindow.js
 	if(t->action != TAGACT_DOCTYPE) {
-		set_property_string(cx, io, "nodeName", upname);
-		set_property_string(cx, io, "tagName", upname);
-		set_property_number(cx, io, "nodeType", 1);
+		set_property_string_a(cx, io, hotatom(NODENAME), upname);
+		set_property_string_a(cx, io, hotatom(TAGNAME), upname);
+		set_property_number_a(cx, io, hotatom(NODETYPE), 1);
 	}
 	connectTagObject(t, io);
 }
@@ -4255,6 +4402,9 @@ void set_gcs_string(const char *name, const char *s)
 void jsClose(void)
 {
 	if(js_running) {
+		int i;
+		for (i = 0; i < HP_MAX; ++i)
+			JS_FreeAtom(mwc, hotatoms[i]);
 		JS_FreeContext(mwc);
 		grabover();
 // release the timer for pending jobs
@@ -157,6 +157,12 @@ static void catchSig(int n)
 	}
 }
 
+// Is this the thread that reads commands and browses pages?
+bool foregroundThread(void)
+{
+	return pthread_equal(foreground_thread, pthread_self());
+}
+
 void setDataSource(char *v)
 {
 	dbarea = dblogin = dbpw = 0;
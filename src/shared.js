@@ -2706,18 +2706,16 @@ td = typeof (data = s);
 if(td != "string") {
 alert3("payload data has improper type " + td);
 }
-this.$entire =  eb$fetchHTTP.call(this, urlcopy,this.method,headerstring,data, pd);
-if(this.$entire != "async") this.parseResponse();
+// The response comes back in pieces: $success $code $url $headers responseText
+if(eb$fetchHTTP.call(this, urlcopy,this.method,headerstring,data, pd) != "async") this.parseResponse();
 };
 
 function xml_parse(){
-var responsebody_array = this.$entire.split("\r\n\r\n");
-var success = parseInt(responsebody_array[0]);
-var code = parseInt(responsebody_array[1]);
-var url2 = responsebody_array[2];
-var http_headers = responsebody_array[3];
-responsebody_array[0] = responsebody_array[1] = responsebody_array[2] = responsebody_array[3] = "";
-this.responseText = responsebody_array.join("\r\n\r\n").trim();
+var success = this.$success;
+var code = this.$code;
+var url2 = this.$url;
+var http_headers = this.$headers;
+this.responseText = this.responseText.trim();
 // some want responseText, some just want response
 this.response = this.responseText;
 var hhc = http_headers.split(/\r?\n/);
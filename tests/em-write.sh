@@ -0,0 +1,28 @@
+#!/bin/sh
+#  Regression test: em maps the file into memory,
+#  and writing the buffer back over that same file must not truncate it
+#  out from under the mapped lines.
+#  usage: em-write.sh [path-to-edbrowse]
+
+EB=${1:-../src/edbrowse}
+T=`mktemp -d` || exit 1
+trap 'rm -rf "$T"' 0
+
+seq 1 20000 > "$T/f"
+cp "$T/f" "$T/want"
+printf 'em f\nw\nq\n' | (cd "$T"; HOME="$T" "$EB" >/dev/null 2>&1)
+if ! cmp -s "$T/f" "$T/want" ; then
+	echo "em-write: file damaged by w after em"
+	exit 1
+fi
+
+#  edit, then write back, the lines that remain must still be right
+seq 6 20000 > "$T/want"
+printf 'em f\n1,5d\nw\nq\n' | (cd "$T"; HOME="$T" "$EB" >/dev/null 2>&1)
+if ! cmp -s "$T/f" "$T/want" ; then
+	echo "em-write: edited file damaged by w after em"
+	exit 1
+fi
+
+echo "em-write: ok"
+exit 0